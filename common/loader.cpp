@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+#include "loader.h"
+
+namespace common {
+
+// The prefetcher faults in at most this much of a mapping, beyond that the
+// kernel's sequential read ahead keeps up with the consumer.
+constexpr size_t kPrefaultBytes = 16 << 20;
+
+LoadedFile::~LoadedFile() { Release(); }
+
+LoadedFile::LoadedFile(LoadedFile&& other) noexcept
+  : buffer_(std::move(other.buffer_)),
+    data_(std::exchange(other.data_, nullptr)),
+    size_(std::exchange(other.size_, 0)),
+    mapped_(std::exchange(other.mapped_, false)) {}
+
+LoadedFile& LoadedFile::operator=(LoadedFile&& other) noexcept {
+  if (this != &other) {
+    Release();
+    buffer_ = std::move(other.buffer_);
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+    mapped_ = std::exchange(other.mapped_, false);
+  }
+  return *this;
+}
+
+void LoadedFile::Release() noexcept {
+  if (mapped_) ::munmap(const_cast<char*>(data_), size_);
+  buffer_.reset();
+  data_ = nullptr;
+  size_ = 0;
+  mapped_ = false;
+}
+
+// Reads until end of file. `size` is only a hint, files may change size
+// while being read and pipes or character devices report none.
+static bool ReadAll(int fd, size_t size, std::unique_ptr<char[]>& buffer, size_t& length) {
+  size_t capacity = std::max<size_t>(size + 1, 4096);
+  buffer.reset(new char[capacity]);
+  length = 0;
+  while (true) {
+    if (length == capacity) {
+      std::unique_ptr<char[]> grown{new char[capacity * 2]};
+      std::copy(buffer.get(), buffer.get() + length, grown.get());
+      buffer = std::move(grown);
+      capacity *= 2;
+    }
+    const ssize_t n = ::read(fd, buffer.get() + length, capacity - length);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    if (n == 0) return true;
+    length += size_t(n);
+  }
+}
+
+LoadedFile LoadFile(const std::string& path, const LoadOptions& options, std::error_code& ec) {
+  ec.clear();
+  LoadedFile out;
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    ec.assign(errno, std::generic_category());
+    return out;
+  }
+
+  struct stat info{};
+  if (::fstat(fd, &info) != 0) {
+    ec.assign(errno, std::generic_category());
+    ::close(fd);
+    return out;
+  }
+  const size_t size = S_ISREG(info.st_mode) ? size_t(info.st_size) : 0;
+
+  if (S_ISREG(info.st_mode) && (size > 0) && (size >= options.mmap_threshold)) {
+    const int flags = MAP_PRIVATE | (options.populate ? MAP_POPULATE : 0);
+    void* mapping = ::mmap(nullptr, size, PROT_READ, flags, fd, 0);
+    if (mapping == MAP_FAILED) {
+      ec.assign(errno, std::generic_category());
+    } else {
+      // advice is a hint, failures are harmless
+      ::madvise(mapping, size, MADV_SEQUENTIAL);
+      if (!options.populate && options.read_ahead) ::madvise(mapping, size, MADV_WILLNEED);
+      if (options.huge_pages) ::madvise(mapping, size, MADV_HUGEPAGE);
+      out.data_ = static_cast<const char*>(mapping);
+      out.size_ = size;
+      out.mapped_ = true;
+    }
+  } else {
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    size_t length = 0;
+    if (ReadAll(fd, size, out.buffer_, length)) {
+      out.data_ = out.buffer_.get();
+      out.size_ = length;
+    } else {
+      ec.assign(errno, std::generic_category());
+      out.buffer_.reset();
+    }
+  }
+  ::close(fd);
+  return out;
+}
+
+// Touches one byte per page so the page faults are taken here rather than
+// by the consumer.
+static void Prefault(const LoadedFile& file, size_t limit) {
+  const size_t page = size_t(::sysconf(_SC_PAGESIZE));
+  const size_t end = std::min(file.size(), limit);
+  unsigned char sum = 0;
+  for (size_t offset = 0; offset < end; offset += page) {
+    sum += static_cast<unsigned char>(*static_cast<const volatile char*>(file.data() + offset));
+  }
+  static_cast<void>(sum);
+}
+
+FilePrefetcher::FilePrefetcher(LoadOptions options)
+  : options_(options), thread_([this]() { Run(); }) {}
+
+FilePrefetcher::~FilePrefetcher() {
+  {
+    std::lock_guard lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+void FilePrefetcher::Push(std::string path) {
+  {
+    std::lock_guard lock(mutex_);
+    paths_.push_back(std::move(path));
+  }
+  cv_.notify_all();
+}
+
+PrefetchedFile FilePrefetcher::Pop() {
+  std::unique_lock lock(mutex_);
+  cv_.wait(lock, [this]() { return !loaded_.empty(); });
+  PrefetchedFile out = std::move(loaded_.front());
+  loaded_.pop_front();
+  lock.unlock();
+  // the slot is free again, start on the next file
+  cv_.notify_all();
+  return out;
+}
+
+size_t FilePrefetcher::Pending() const {
+  std::lock_guard lock(mutex_);
+  return paths_.size() + loaded_.size() + (loading_ ? 1 : 0);
+}
+
+void FilePrefetcher::Run() {
+  std::unique_lock lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this]() { return stop_ || (!paths_.empty() && loaded_.empty()); });
+    if (stop_) return;
+
+    PrefetchedFile next;
+    next.path = std::move(paths_.front());
+    paths_.pop_front();
+    loading_ = true;
+    lock.unlock();
+
+    next.file = LoadFile(next.path, options_, next.ec);
+    if (next.file.IsMapped() && !options_.populate && options_.read_ahead) Prefault(next.file, kPrefaultBytes);
+
+    lock.lock();
+    loading_ = false;
+    loaded_.push_back(std::move(next));
+    cv_.notify_all();
+  }
+}
+
+} // namespace common
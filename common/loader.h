@@ -0,0 +1,100 @@
+#ifndef COMMON_LOADER_H_
+#define COMMON_LOADER_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+namespace common {
+
+struct LoadOptions {
+  // files smaller than this are read(2) into memory, larger ones are mapped.
+  // Reading is cheaper than setting up and tearing down a mapping for small
+  // files, mapping avoids the copy for large ones.
+  size_t mmap_threshold{256 << 10};
+  // fault the whole mapping in up front (MAP_POPULATE)
+  bool populate{false};
+  // read the whole file ahead (MADV_WILLNEED, prefetcher faulting pages in);
+  // off for callers that usually stop early, so only the pages up to where
+  // they stop are read
+  bool read_ahead{true};
+  // ask for transparent huge pages on mappings (MADV_HUGEPAGE), only honoured
+  // by kernels and filesystems that support it for file backed memory
+  bool huge_pages{false};
+};
+
+// Contents of a file, either in an owned buffer or mapped read only.
+class LoadedFile {
+ public:
+  LoadedFile() = default;
+  ~LoadedFile();
+  LoadedFile(LoadedFile&& other) noexcept;
+  LoadedFile& operator=(LoadedFile&& other) noexcept;
+  LoadedFile(const LoadedFile&) = delete;
+  LoadedFile& operator=(const LoadedFile&) = delete;
+
+  const char* data() const noexcept { return data_; }
+  size_t size() const noexcept { return size_; }
+  std::string_view View() const noexcept { return {data_, size_}; }
+  bool IsMapped() const noexcept { return mapped_; }
+
+ private:
+  friend LoadedFile LoadFile(const std::string& path, const LoadOptions& options, std::error_code& ec);
+  void Release() noexcept;
+
+  std::unique_ptr<char[]> buffer_;
+  const char* data_{nullptr};
+  size_t size_{0};
+  bool mapped_{false};
+};
+
+// Loads `path` as described by `options`. Mappings are advised for sequential
+// access and read ahead (MADV_SEQUENTIAL, MADV_WILLNEED). On failure `ec` is
+// set and an empty file is returned.
+LoadedFile LoadFile(const std::string& path, const LoadOptions& options, std::error_code& ec);
+
+struct PrefetchedFile {
+  std::string path;
+  LoadedFile file;
+  std::error_code ec;
+};
+
+// Loads files in the order they are pushed on a background thread, one file
+// ahead of the consumer: while file N is processed, file N+1 is opened and
+// read, or mapped and its first pages faulted in, so the consumer does not
+// stall on cold caches or slow disks.
+class FilePrefetcher {
+ public:
+  explicit FilePrefetcher(LoadOptions options = {});
+  ~FilePrefetcher();
+  FilePrefetcher(const FilePrefetcher&) = delete;
+  FilePrefetcher& operator=(const FilePrefetcher&) = delete;
+
+  void Push(std::string path);
+  // Returns the oldest pushed file that was not popped yet, waiting until it
+  // is loaded. Must only be called while Pending() is not zero.
+  PrefetchedFile Pop();
+  size_t Pending() const;
+
+ private:
+  void Run();
+
+  const LoadOptions options_;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::string> paths_;
+  std::deque<PrefetchedFile> loaded_;
+  bool loading_{false};
+  bool stop_{false};
+  std::thread thread_;
+};
+
+} // namespace common
+
+#endif // COMMON_LOADER_H_
@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <fcntl.h>
+#include <initializer_list>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <utility>
+
+#include "batch_read.h"
+#include "stats.h"
+
+namespace gai {
+
+// Minimal io_uring driven through the raw system calls: one submitter, one
+// reaper, both the owning thread.
+struct BatchReader::Ring {
+  int fd{-1};
+  void* sq_ring{MAP_FAILED};
+  size_t sq_ring_size{0};
+  void* cq_ring{MAP_FAILED};
+  size_t cq_ring_size{0};
+  io_uring_sqe* sqes{static_cast<io_uring_sqe*>(MAP_FAILED)};
+  size_t sqes_size{0};
+
+  unsigned* sq_tail{nullptr};
+  unsigned* sq_mask{nullptr};
+  unsigned* sq_array{nullptr};
+  unsigned* cq_head{nullptr};
+  unsigned* cq_tail{nullptr};
+  unsigned* cq_mask{nullptr};
+  io_uring_cqe* cqes{nullptr};
+  // sqes filled in since the last submission
+  unsigned queued{0};
+  unsigned local_tail{0};
+
+  Ring() = default;
+  Ring(const Ring&) = delete;
+  Ring& operator=(const Ring&) = delete;
+  ~Ring() {
+    if (sqes != MAP_FAILED) ::munmap(sqes, sqes_size);
+    if ((cq_ring != MAP_FAILED) && (cq_ring != sq_ring)) ::munmap(cq_ring, cq_ring_size);
+    if (sq_ring != MAP_FAILED) ::munmap(sq_ring, sq_ring_size);
+    if (fd >= 0) ::close(fd);
+  }
+
+  // Returns nullptr when io_uring or one of the needed operations is unavailable.
+  static std::unique_ptr<Ring> Create(unsigned entries) {
+    auto ring = std::make_unique<Ring>();
+    io_uring_params params{};
+    ring->fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if (ring->fd < 0) return nullptr;
+    if (!ring->Supports({IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE})) return nullptr;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) ring->sq_ring_size = ring->cq_ring_size = std::max(ring->sq_ring_size, ring->cq_ring_size);
+
+    ring->sq_ring = ::mmap(nullptr, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) return nullptr;
+    ring->cq_ring = single_mmap ? ring->sq_ring
+                                : ::mmap(nullptr, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                                         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ring == MAP_FAILED) return nullptr;
+    ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    ring->sqes = static_cast<io_uring_sqe*>(::mmap(nullptr, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                                   MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES));
+    if (ring->sqes == MAP_FAILED) return nullptr;
+
+    auto* sq = static_cast<char*>(ring->sq_ring);
+    auto* cq = static_cast<char*>(ring->cq_ring);
+    ring->sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    ring->sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    ring->sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    ring->cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    ring->cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    ring->cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    ring->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    ring->local_tail = *ring->sq_tail;
+    return ring;
+  }
+
+  bool Supports(std::initializer_list<unsigned> opcodes) const {
+    constexpr unsigned kMaxOps = 256;
+    std::vector<unsigned char> storage(sizeof(io_uring_probe) + kMaxOps * sizeof(io_uring_probe_op), 0);
+    auto* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+    if (::syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, kMaxOps) < 0) return false;
+    return std::all_of(opcodes.begin(), opcodes.end(), [probe](unsigned op) {
+      return (op <= probe->last_op) && ((probe->ops[op].flags & IO_URING_OP_SUPPORTED) != 0);
+    });
+  }
+
+  io_uring_sqe* Next() {
+    const unsigned index = local_tail++ & *sq_mask;
+    sq_array[index] = index;
+    ++queued;
+    io_uring_sqe* sqe = &sqes[index];
+    *sqe = io_uring_sqe{};
+    return sqe;
+  }
+
+  // Submits the queued entries and passes `count` completions to `on_complete`.
+  template <typename F>
+  bool SubmitAndWait(unsigned count, F&& on_complete) {
+    std::atomic_ref<unsigned>(*sq_tail).store(local_tail, std::memory_order_release);
+    unsigned to_submit = std::exchange(queued, 0);
+    unsigned reaped = 0;
+    while (reaped < count) {
+      const long rc = ::syscall(__NR_io_uring_enter, fd, to_submit, count - reaped, IORING_ENTER_GETEVENTS,
+                                nullptr, 0);
+      if (rc < 0) {
+        if (errno == EINTR) continue;
+        return false;
+      }
+      to_submit -= std::min<unsigned>(to_submit, static_cast<unsigned>(rc));
+
+      unsigned head = std::atomic_ref<unsigned>(*cq_head).load(std::memory_order_relaxed);
+      const unsigned tail = std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire);
+      for (; (head != tail) && (reaped < count); ++head, ++reaped) {
+        const io_uring_cqe& cqe = cqes[head & *cq_mask];
+        on_complete(cqe.user_data, cqe.res);
+      }
+      std::atomic_ref<unsigned>(*cq_head).store(head, std::memory_order_release);
+    }
+    return true;
+  }
+};
+
+BatchReader::BatchReader(bool use_io_uring) : buffers_(kMaxBatch) {
+  // openat + statx for every file of a batch
+  if (use_io_uring) ring_ = Ring::Create(2 * kMaxBatch);
+}
+
+BatchReader::~BatchReader() = default;
+
+char* BatchReader::Reserve(size_t k, size_t size) {
+  Buffer& buffer = buffers_[k];
+  if ((buffer.capacity < size) || !buffer.data) {
+    buffer.capacity = std::max({size, 2 * buffer.capacity, size_t{4096}});
+    buffer.data = std::make_unique_for_overwrite<char[]>(buffer.capacity);
+  }
+  return buffer.data.get();
+}
+
+const std::vector<BatchedFile>& BatchReader::Read(const std::vector<std::string>& paths) {
+  StageTimer timer(Stage::kInput);
+  files_.assign(std::min(paths.size(), kMaxBatch), BatchedFile{});
+  if (ring_) {
+    ReadWithIoUring(paths);
+  } else {
+    ReadWithSyscalls(paths);
+  }
+  return files_;
+}
+
+void BatchReader::ReadWithIoUring(const std::vector<std::string>& paths) {
+  const size_t n = files_.size();
+  std::vector<int> fds(n, -1);
+  std::vector<struct statx> stats(n);
+  std::vector<bool> stat_ok(n, false);
+
+  for (size_t i = 0; i < n; ++i) {
+    io_uring_sqe* open = ring_->Next();
+    open->opcode = IORING_OP_OPENAT;
+    open->fd = AT_FDCWD;
+    open->addr = reinterpret_cast<uint64_t>(paths[i].c_str());
+    open->open_flags = O_RDONLY | O_CLOEXEC;
+    open->user_data = 2 * i;
+
+    io_uring_sqe* stat = ring_->Next();
+    stat->opcode = IORING_OP_STATX;
+    stat->fd = AT_FDCWD;
+    stat->addr = reinterpret_cast<uint64_t>(paths[i].c_str());
+    stat->len = STATX_TYPE | STATX_SIZE;
+    stat->off = reinterpret_cast<uint64_t>(&stats[i]);
+    stat->user_data = 2 * i + 1;
+  }
+  const bool opened = ring_->SubmitAndWait(static_cast<unsigned>(2 * n), [&](uint64_t user_data, int res) {
+    const size_t i = user_data / 2;
+    if (user_data % 2 == 0) {
+      fds[i] = res;
+    } else {
+      stat_ok[i] = (res == 0);
+    }
+  });
+
+  // the read is hard linked to the close, so the descriptor is closed even
+  // when the read fails or comes back short
+  bool ok = opened;
+  unsigned expected = 0;
+  for (size_t i = 0; ok && (i < n); ++i) {
+    if (fds[i] < 0) continue;
+    const bool regular = stat_ok[i] && S_ISREG(stats[i].stx_mode);
+    if (regular && (stats[i].stx_size <= kMaxFileSize)) {
+      io_uring_sqe* read = ring_->Next();
+      read->opcode = IORING_OP_READ;
+      read->flags = IOSQE_IO_HARDLINK;
+      read->fd = fds[i];
+      read->addr = reinterpret_cast<uint64_t>(Reserve(i, stats[i].stx_size));
+      read->len = static_cast<uint32_t>(stats[i].stx_size);
+      read->off = 0;
+      read->user_data = 2 * i;
+      ++expected;
+    } else {
+      files_[i].deferred = true;
+    }
+    io_uring_sqe* close = ring_->Next();
+    close->opcode = IORING_OP_CLOSE;
+    close->fd = fds[i];
+    close->user_data = 2 * i + 1;
+    ++expected;
+  }
+  if (ok && (expected > 0)) {
+    ok = ring_->SubmitAndWait(expected, [&](uint64_t user_data, int res) {
+      const size_t i = user_data / 2;
+      if ((user_data % 2 == 0) && (res >= 0)) {
+        files_[i].contents = {buffers_[i].data.get(), static_cast<size_t>(res)};
+        files_[i].ok = true;
+      }
+    });
+  }
+
+  if (!ok) {
+    // The ring is unusable. Descriptors it opened are closed here when the
+    // open step failed; after that their closes were submitted already.
+    if (!opened) {
+      for (const int fd : fds) {
+        if (fd >= 0) ::close(fd);
+      }
+    }
+    ring_.reset();
+    files_.assign(n, BatchedFile{});
+    ReadWithSyscalls(paths);
+  }
+}
+
+void BatchReader::ReadWithSyscalls(const std::vector<std::string>& paths) {
+  for (size_t i = 0; i < files_.size(); ++i) {
+    const int fd = ::open(paths[i].c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) continue;
+
+    struct stat info{};
+    const bool regular = (::fstat(fd, &info) == 0) && S_ISREG(info.st_mode);
+    if (!regular || (static_cast<size_t>(info.st_size) > kMaxFileSize)) {
+      files_[i].deferred = true;
+      ::close(fd);
+      continue;
+    }
+
+    const size_t size = static_cast<size_t>(info.st_size);
+    char* data = Reserve(i, size);
+    size_t done = 0;
+    bool failed = false;
+    while (done < size) {
+      const ssize_t n = ::read(fd, data + done, size - done);
+      if (n > 0) {
+        done += static_cast<size_t>(n);
+      } else if (n == 0) {
+        break;
+      } else if (errno != EINTR) {
+        failed = true;
+        break;
+      }
+    }
+    ::close(fd);
+    if (!failed) files_[i] = BatchedFile{{data, done}, true, false};
+  }
+}
+
+} // namespace gai
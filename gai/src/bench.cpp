@@ -0,0 +1,373 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fcntl.h>
+#include <functional>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+
+#include "args.h"
+#include "format.h"
+#include "input.h"
+#include "output.h"
+#include "pipeline.h"
+#include "process.h"
+#include "regex.h"
+#include "printx.hpp"
+
+namespace gai {
+
+// A generated input and the text a configurable share of its lines contains.
+struct Corpus {
+  std::string name;
+  std::string text;
+  std::string needle;
+  std::vector<std::string_view> lines;
+};
+
+struct Config {
+  bool jit{true};
+  bool utf{false};
+  size_t patterns{1};
+};
+
+// Policy of the --utf runs, subjects validated once per buffer as with
+// --utf-invalid=replace.
+constexpr InvalidUtf8 kBenchInvalidUtf8 = InvalidUtf8::kReplace;
+
+struct Result {
+  std::string name;
+  std::string corpus;
+  Config config;
+  size_t runs{0};
+  double mb_per_s{0};
+  double mb_per_s_stddev{0};
+  double lines_per_s{0};
+};
+
+// Corpora are generated from a fixed seed, so runs of two builds on the same
+// machine see the same bytes and their numbers can be compared.
+constexpr uint64_t kSeed = 0x6a09e667f3bcc908;
+
+constexpr std::string_view kWords[] = {"request", "handled", "user",   "session", "timeout",  "cache",
+                                       "backend", "latency", "retry",  "socket",  "payload",  "commit",
+                                       "shard",   "replica", "leader", "queue",   "snapshot", "token"};
+constexpr std::string_view kUtfWords[] = {"запрос", "ошибка",  "пользователь", "καθυστέρηση", "σύνδεση",
+                                          "キャッシュ", "タイムアウト", "服务器", "请求",          "💾",
+                                          "naïve",  "façade",  "straße",       "🚀"};
+
+// Appends words from `words` to `line` until it is at least `length` bytes.
+template <size_t N>
+static void AppendWords(std::string& line, const std::string_view (&words)[N], size_t length, std::mt19937_64& rng) {
+  std::uniform_int_distribution<size_t> pick(0, N - 1);
+  while (line.size() < length) {
+    line.append(words[pick(rng)]);
+    line.push_back(' ');
+  }
+}
+
+// Log lines like "2025-10-01T12:00:07.123 level=INFO user_id=42 msg=...",
+// `match_rate` of them at level ERROR.
+static Corpus LogCorpus(std::string name, size_t size, double match_rate) {
+  Corpus corpus{std::move(name), {}, "level=ERROR", {}};
+  std::mt19937_64 rng(kSeed);
+  std::bernoulli_distribution hit(match_rate);
+  std::uniform_int_distribution<int> user(0, 99999);
+  std::uniform_int_distribution<size_t> length(60, 160);
+  std::string line;
+  for (size_t second = 0; corpus.text.size() < size; ++second) {
+    line.clear();
+    line.append(common::FormatIntoStringView<"2025-10-01T%02d:%02d:%02d.%03d">(
+      int(second / 3600 % 24), int(second / 60 % 60), int(second % 60), int(second * 7 % 1000)));
+    line.append(hit(rng) ? " level=ERROR" : ((second % 7 == 0) ? " level=WARN" : " level=INFO"));
+    line.append(" user_id=").append(std::to_string(user(rng))).append(" msg=");
+    AppendWords(line, kWords, length(rng), rng);
+    corpus.text.append(line).push_back('\n');
+  }
+  return corpus;
+}
+
+// Lines of 4 to 16 KiB, every 50th holds the needle somewhere in the middle.
+static Corpus LongLineCorpus(size_t size) {
+  Corpus corpus{"long-line", {}, "needle_in_haystack", {}};
+  std::mt19937_64 rng(kSeed);
+  std::uniform_int_distribution<size_t> length(4 << 10, 16 << 10);
+  std::string line;
+  for (size_t k = 0; corpus.text.size() < size; ++k) {
+    line.clear();
+    const size_t n = length(rng);
+    AppendWords(line, kWords, n / 2, rng);
+    if (k % 50 == 0) line.append(corpus.needle).push_back(' ');
+    AppendWords(line, kWords, n, rng);
+    corpus.text.append(line).push_back('\n');
+  }
+  return corpus;
+}
+
+// Mostly multi-byte UTF-8 text, one line in 20 contains the needle.
+static Corpus UtfCorpus(size_t size) {
+  Corpus corpus{"utf8", {}, "ошибка соединения", {}};
+  std::mt19937_64 rng(kSeed);
+  std::uniform_int_distribution<size_t> length(40, 200);
+  std::string line;
+  for (size_t k = 0; corpus.text.size() < size; ++k) {
+    line.clear();
+    AppendWords(line, kUtfWords, length(rng), rng);
+    if (k % 20 == 0) line.append(corpus.needle);
+    corpus.text.append(line).push_back('\n');
+  }
+  return corpus;
+}
+
+static std::vector<Corpus> MakeCorpora(size_t size) {
+  std::vector<Corpus> corpora;
+  corpora.push_back(LogCorpus("log", size, 0.01));
+  corpora.push_back(LongLineCorpus(size));
+  corpora.push_back(LogCorpus("high-match", size, 0.9));
+  corpora.push_back(LogCorpus("low-match", size, 0.0001));
+  corpora.push_back(UtfCorpus(size));
+  for (Corpus& corpus : corpora) {
+    InputMemMappedFile input(corpus.text.data(), corpus.text.data() + corpus.text.size());
+    while (const std::optional<std::string_view> line = input.GetLine()) corpus.lines.push_back(*line);
+  }
+  return corpora;
+}
+
+// The needle followed by patterns that rarely or never match, so a set of
+// `count` costs more the larger it gets but finds the same lines.
+static std::vector<std::string> MakePatterns(const Corpus& corpus, size_t count) {
+  std::vector<std::string> patterns{corpus.needle};
+  for (size_t k = 1; k < count; ++k) {
+    patterns.push_back((k % 2) ? "missing_key_" + std::to_string(k) + "=\\d+"
+                               : "(?:alpha|omega)" + std::to_string(k) + "[a-z]+");
+  }
+  return patterns;
+}
+
+// Runs `body` once to warm caches and JIT stacks, then `runs` times timed.
+// Every run goes through the whole corpus.
+static Result Measure(std::string name, const Corpus& corpus, Config config, size_t runs,
+                      const std::function<void()>& body) {
+  body();
+  std::vector<double> seconds;
+  seconds.reserve(runs);
+  for (size_t k = 0; k < runs; ++k) {
+    const auto start = std::chrono::steady_clock::now();
+    body();
+    seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+  }
+
+  const double mb = double(corpus.text.size()) / (1 << 20);
+  double mean = 0;
+  double lines = 0;
+  for (const double s : seconds) {
+    mean += mb / s;
+    lines += double(corpus.lines.size()) / s;
+  }
+  mean /= double(runs);
+  double variance = 0;
+  for (const double s : seconds) variance += (mb / s - mean) * (mb / s - mean);
+  variance /= double(std::max<size_t>(runs - 1, 1));
+  return {std::move(name), corpus.name, config, runs, mean, std::sqrt(variance), lines / double(runs)};
+}
+
+// Keeps the optimiser from dropping the work of a benchmark.
+static volatile size_t sink_counter = 0;
+
+static void Micro(const Corpus& corpus, Config config, size_t runs, std::vector<Result>& results,
+                  const std::function<bool(std::string_view)>& selected) {
+  if (selected("find")) {
+    const Pcre2Regex regex = Regex(Compile(corpus.needle, config.jit, config.utf, kBenchInvalidUtf8));
+    results.push_back(Measure("find", corpus, config, runs, [&]() {
+      size_t found = 0;
+      for (const std::string_view line : corpus.lines) found += Find(regex, line);
+      sink_counter = found;
+    }));
+  }
+  if (selected("substitute")) {
+    const Pcre2Substitution sub(Compile(corpus.needle, config.jit, config.utf, kBenchInvalidUtf8), "<$0>");
+    std::string scratch;
+    results.push_back(Measure("substitute", corpus, config, runs, [&]() {
+      size_t bytes = 0;
+      for (const std::string_view line : corpus.lines) bytes += Substitute(sub, line, scratch).size();
+      sink_counter = bytes;
+    }));
+  }
+  if (selected("getline") && (config.patterns == 1) && config.jit && !config.utf) {
+    results.push_back(Measure("getline", corpus, config, runs, [&]() {
+      InputMemMappedFile input(corpus.text.data(), corpus.text.data() + corpus.text.size());
+      size_t lines = 0;
+      while (input.GetLine()) ++lines;
+      sink_counter = lines;
+    }));
+  }
+  if (selected("getlines") && (config.patterns == 1) && config.jit && !config.utf) {
+    std::vector<std::string_view> batch(4096);
+    results.push_back(Measure("getlines", corpus, config, runs, [&]() {
+      InputMemMappedFile input(corpus.text.data(), corpus.text.data() + corpus.text.size());
+      size_t lines = 0;
+      while (const size_t count = input.GetLines(batch.data(), batch.size())) lines += count;
+      sink_counter = lines;
+    }));
+  }
+}
+
+// Whole pipeline, line by line (Process), over the buffer (ProcessBuffer) and
+// pushed in chunks (Pipeline); the first two print to /dev/null through the
+// same writev path as the tool.
+static void Macro(const Corpus& corpus, Config config, size_t runs, int null_fd, std::vector<Result>& results,
+                  const std::function<bool(std::string_view)>& selected) {
+  const std::vector<std::string> storage = MakePatterns(corpus, config.patterns);
+  const std::vector<std::string_view> patterns(storage.begin(), storage.end());
+  const Pcre2PatternSet filters = CompileSet(patterns, config.jit, config.utf, kBenchInvalidUtf8);
+  OutputSink out(null_fd, false, ":");
+  out.SetSource(corpus.text);
+
+  if (selected("process")) {
+    results.push_back(Measure("process", corpus, config, runs, [&]() {
+      std::optional<Range> range;
+      InputMemMappedFile input(corpus.text.data(), corpus.text.data() + corpus.text.size());
+      Process(filters, {}, {}, out, range, &input);
+      out.Flush();
+    }));
+  }
+  if (selected("process-buffer")) {
+    results.push_back(Measure("process-buffer", corpus, config, runs, [&]() {
+      std::optional<Range> range;
+      ProcessBuffer(filters, {}, {}, out, range, corpus.text);
+      out.Flush();
+    }));
+  }
+  if (selected("pipeline")) {
+    // pushed in blocks the size of a socket or pipe read, into a sink that
+    // only adds up what it is handed
+    constexpr size_t kChunkSize = 64 << 10;
+    Pipeline pipeline(std::make_shared<const Patterns>(
+      Patterns{CompileSet(patterns, config.jit, config.utf, kBenchInvalidUtf8), {}, {}, std::nullopt}));
+    results.push_back(Measure("pipeline", corpus, config, runs, [&]() {
+      size_t bytes = 0;
+      auto sink = [&bytes](std::string_view line, size_t) { bytes += line.size(); };
+      for (size_t pos = 0; pos < corpus.text.size(); pos += kChunkSize) {
+        pipeline.Push(std::string_view{corpus.text}.substr(pos, kChunkSize), sink);
+      }
+      pipeline.Finish(sink);
+      sink_counter = bytes;
+    }));
+  }
+}
+
+static void PrintText(const std::vector<Result>& results) {
+  rostd::printf<"%-15s %-11s %-4s %-4s %8s %12s %10s %14s\n">("benchmark", "corpus", "jit", "utf", "patterns",
+                                                            "MB/s", "+-", "lines/s");
+  for (const Result& r : results) {
+    rostd::printf<"%-15s %-11s %-4s %-4s %8zu %12.1f %10.1f %14.0f\n">(
+      r.name, r.corpus, r.config.jit ? "on" : "off", r.config.utf ? "on" : "off", r.config.patterns, r.mb_per_s,
+      r.mb_per_s_stddev, r.lines_per_s);
+  }
+}
+
+static void PrintCsv(const std::vector<Result>& results) {
+  rostd::printf<"benchmark,corpus,jit,utf,patterns,runs,mb_per_s,mb_per_s_stddev,lines_per_s\n">();
+  for (const Result& r : results) {
+    rostd::printf<"%s,%s,%d,%d,%zu,%zu,%.3f,%.3f,%.1f\n">(r.name, r.corpus, int(r.config.jit), int(r.config.utf),
+                                                          r.config.patterns, r.runs, r.mb_per_s, r.mb_per_s_stddev,
+                                                          r.lines_per_s);
+  }
+}
+
+static void PrintJson(const std::vector<Result>& results) {
+  rostd::printf<"[\n">();
+  for (size_t k = 0; k < results.size(); ++k) {
+    const Result& r = results[k];
+    rostd::printf<"  {\"benchmark\": \"%s\", \"corpus\": \"%s\", \"jit\": %s, \"utf\": %s, \"patterns\": %zu, "
+                  "\"runs\": %zu, \"mb_per_s\": %.3f, \"mb_per_s_stddev\": %.3f, \"lines_per_s\": %.1f}%s\n">(
+      r.name, r.corpus, r.config.jit ? "true" : "false", r.config.utf ? "true" : "false", r.config.patterns, r.runs,
+      r.mb_per_s, r.mb_per_s_stddev, r.lines_per_s, (k + 1 < results.size()) ? "," : "");
+  }
+  rostd::printf<"]\n">();
+}
+
+} // namespace gai
+
+int main(int argc, char** argv) {
+  common::Args cli(argc, argv);
+
+  constexpr const char* kCliHelpMessage = R"CLI(
+Usage: gai_bench [OPTIONS]
+
+Times the matching primitives (find, substitute, getline, getlines) and
+whole runs (process, process-buffer, pipeline) over generated corpora: log, long-line,
+high-match, low-match and utf8. Whole runs are swept over JIT on and off,
+--utf on and off and pattern set sizes.
+
+Options:
+      --size                Size of every corpus in MiB (default: 16)
+      --runs                Timed runs per benchmark, after one warm up run (default: 5)
+      --benchmarks          Benchmarks to run (default: all)
+      --corpora             Corpora to run them over (default: all)
+      --patterns            Pattern set sizes of the whole runs (default: [1, 8])
+      --format              Output format: text, csv or json (default: text)
+  -h, --help                Show this help message
+  )CLI";
+
+  if (cli.Has("-h") || cli.Has("--help")) {
+    rostd::printf<"%s">(kCliHelpMessage);
+    return EXIT_SUCCESS;
+  }
+
+  try {
+    using VecStringView = std::vector<std::string_view>;
+    const size_t size = std::stoul(std::string{cli.Value({"--size"}).value_or("16")}) << 20;
+    const size_t runs = std::max<size_t>(std::stoul(std::string{cli.Value({"--runs"}).value_or("5")}), 1);
+    const VecStringView benchmarks = cli.MultiValue({"--benchmarks"}, true).value_or(VecStringView{});
+    const VecStringView corpora = cli.MultiValue({"--corpora"}, true).value_or(VecStringView{});
+    std::vector<size_t> pattern_counts;
+    for (const std::string_view count : cli.MultiValue({"--patterns"}, true).value_or(VecStringView{})) {
+      pattern_counts.push_back(std::max<size_t>(std::stoul(std::string{count}), 1));
+    }
+    if (pattern_counts.empty()) pattern_counts = {1, 8};
+    const std::string_view format = cli.Value({"--format"}).value_or("text");
+    if ((format != "text") && (format != "csv") && (format != "json")) {
+      throw std::runtime_error("Unknown --format, expected text, csv or json");
+    }
+
+    const auto listed = [](const VecStringView& names, std::string_view name) {
+      return names.empty() || (std::find(names.begin(), names.end(), name) != names.end());
+    };
+    const auto benchmark_selected = [&](std::string_view name) { return listed(benchmarks, name); };
+
+    const int null_fd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (null_fd < 0) throw std::runtime_error("Unable to open /dev/null");
+
+    std::vector<gai::Result> results;
+    for (const gai::Corpus& corpus : gai::MakeCorpora(size)) {
+      if (!listed(corpora, corpus.name)) continue;
+      for (const bool jit : {true, false}) {
+        for (const bool utf : {false, true}) {
+          gai::Micro(corpus, {jit, utf, 1}, runs, results, benchmark_selected);
+          for (const size_t count : pattern_counts) {
+            gai::Macro(corpus, {jit, utf, count}, runs, null_fd, results, benchmark_selected);
+          }
+        }
+      }
+    }
+    ::close(null_fd);
+
+    if (format == "csv") {
+      gai::PrintCsv(results);
+    } else if (format == "json") {
+      gai::PrintJson(results);
+    } else {
+      gai::PrintText(results);
+    }
+  } catch (const std::exception& ex) {
+    rostd::printf<"Exception raised!!\nException: %s\n">(ex.what());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
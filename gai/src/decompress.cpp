@@ -0,0 +1,195 @@
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <zlib.h>
+#include <zstd.h>
+
+#include "decompress.h"
+#include "stats.h"
+
+namespace gai {
+
+constexpr std::string_view kGzipMagic = "\x1f\x8b";
+constexpr std::string_view kZstdMagic = "\x28\xb5\x2f\xfd";
+
+Compression DetectCompression(std::string_view head) {
+  if (head.starts_with(kGzipMagic)) return Compression::kGzip;
+  if (head.starts_with(kZstdMagic)) return Compression::kZstd;
+  return Compression::kNone;
+}
+
+// Fills `out` with decompressed data; returns the number of bytes written,
+// less than `capacity` only at the end of the stream. Throws on bad data.
+using Decoder = std::function<size_t(char* out, size_t capacity)>;
+
+static Decoder GzipDecoder(std::string_view in, std::shared_ptr<z_stream>& stream) {
+  stream.reset(new z_stream{}, [](z_stream* s) {
+    inflateEnd(s);
+    delete s;
+  });
+  // 32 lets zlib accept gzip and zlib headers
+  if (inflateInit2(stream.get(), 15 + 32) != Z_OK) throw std::runtime_error("Unable to initialise zlib");
+
+  return [in, zs = stream.get(), done = false](char* out, size_t capacity) mutable -> size_t {
+    zs->next_out = reinterpret_cast<Bytef*>(out);
+    zs->avail_out = static_cast<uInt>(capacity);
+    while (!done && (zs->avail_out > 0)) {
+      if (zs->avail_in == 0) {
+        const size_t n = std::min<size_t>(in.size(), std::numeric_limits<uInt>::max());
+        zs->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+        zs->avail_in = static_cast<uInt>(n);
+        in.remove_prefix(n);
+      }
+      const int ret = inflate(zs, Z_NO_FLUSH);
+      if (ret == Z_STREAM_END) {
+        // another member may follow, like with `cat a.gz b.gz`; anything else
+        // after a member is ignored the way gzip(1) does
+        const std::string_view rest{reinterpret_cast<const char*>(zs->next_in), zs->avail_in};
+        if ((rest.empty() && in.empty()) || !(rest.empty() ? in : rest).starts_with(kGzipMagic)) {
+          done = true;
+        } else {
+          inflateReset(zs);
+        }
+      } else if ((ret == Z_BUF_ERROR) && (zs->avail_in == 0) && in.empty()) {
+        throw std::runtime_error("Unable to decompress input: unexpected end of gzip data");
+      } else if ((ret != Z_OK) && (ret != Z_BUF_ERROR)) {
+        throw std::runtime_error(std::string("Unable to decompress input: ") + (zs->msg ? zs->msg : "bad gzip data"));
+      }
+    }
+    return capacity - zs->avail_out;
+  };
+}
+
+static Decoder ZstdDecoder(std::string_view in, std::shared_ptr<ZSTD_DCtx>& context) {
+  context.reset(ZSTD_createDCtx(), [](ZSTD_DCtx* c) { ZSTD_freeDCtx(c); });
+  if (!context) throw std::runtime_error("Unable to initialise zstd");
+
+  return [input = ZSTD_inBuffer{in.data(), in.size(), 0}, dctx = context.get(),
+          pending = size_t{0}](char* out, size_t capacity) mutable -> size_t {
+    ZSTD_outBuffer output{out, capacity, 0};
+    while (output.pos < output.size) {
+      if ((input.pos == input.size) && (pending == 0)) break;
+      const size_t last_pos = output.pos;
+      pending = ZSTD_decompressStream(dctx, &output, &input);
+      if (ZSTD_isError(pending)) {
+        throw std::runtime_error(std::string("Unable to decompress input: ") + ZSTD_getErrorName(pending));
+      }
+      // all input consumed, no progress and the frame is not complete
+      if ((input.pos == input.size) && (output.pos == last_pos) && (pending != 0)) {
+        throw std::runtime_error("Unable to decompress input: unexpected end of zstd data");
+      }
+    }
+    return output.pos;
+  };
+}
+
+DecompressingInput::DecompressingInput(std::string_view compressed, Compression compression)
+  : InputBase(true), compressed_(compressed), compression_(compression) {
+  for (Block& block : ring_) block.data.reset(new char[kBlockSize]);
+  reader_ = std::thread([this]() { Run(); });
+}
+
+DecompressingInput::~DecompressingInput() {
+  {
+    std::lock_guard lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  reader_.join();
+}
+
+void DecompressingInput::Run() {
+  try {
+    std::shared_ptr<z_stream> gzip_state;
+    std::shared_ptr<ZSTD_DCtx> zstd_state;
+    Decoder decode = (compression_ == Compression::kZstd) ? ZstdDecoder(compressed_, zstd_state)
+                                                          : GzipDecoder(compressed_, gzip_state);
+    while (Block* block = AcquireFree()) {
+      block->size = decode(block->data.get(), kBlockSize);
+      const bool last = block->size < kBlockSize;
+      Publish(last);
+      if (last) return;
+    }
+  } catch (const std::exception& ex) {
+    std::lock_guard lock(mutex_);
+    error_ = ex.what();
+    finished_ = true;
+    cv_.notify_all();
+  }
+}
+
+DecompressingInput::Block* DecompressingInput::AcquireFree() {
+  std::unique_lock lock(mutex_);
+  cv_.wait(lock, [this]() { return stop_ || (produced_ - consumed_ < kBlocks); });
+  return stop_ ? nullptr : &ring_[produced_ % kBlocks];
+}
+
+void DecompressingInput::Publish(bool last) {
+  {
+    std::lock_guard lock(mutex_);
+    ++produced_;
+    finished_ = last;
+  }
+  cv_.notify_all();
+}
+
+DecompressingInput::Block* DecompressingInput::AcquireFilled() {
+  StageTimer timer(Stage::kInput);
+  std::unique_lock lock(mutex_);
+  cv_.wait(lock, [this]() { return finished_ || (produced_ > consumed_); });
+  if (produced_ > consumed_) return &ring_[consumed_ % kBlocks];
+  if (!error_.empty()) throw DecompressError(error_);
+  return nullptr;
+}
+
+void DecompressingInput::Release() {
+  {
+    std::lock_guard lock(mutex_);
+    ++consumed_;
+  }
+  cv_.notify_all();
+  current_ = nullptr;
+}
+
+std::optional<std::string_view> DecompressingInput::GetLine() {
+  if (carried_) {
+    carry_.clear();
+    carried_ = false;
+  }
+  while (true) {
+    if (current_) {
+      const char* start = current_->data.get() + pos_;
+      const size_t remaining = current_->size - pos_;
+      const char* newline_ptr = static_cast<const char*>(std::memchr(start, '\n', remaining));
+      if (newline_ptr) {
+        std::string_view line(start, newline_ptr - start);
+        pos_ += line.size() + 1;
+        if (carry_.empty()) {
+          history_.Advance(line);
+          return line;
+        }
+        carry_.append(line);
+        carried_ = true;
+        history_.Advance(carry_);
+        return carry_;
+      }
+      carry_.append(start, remaining);
+      Release();
+    }
+    current_ = AcquireFilled();
+    if (!current_) break;
+    pos_ = 0;
+  }
+
+  // handle last line without newline
+  if (!carry_.empty()) {
+    carried_ = true;
+    history_.Advance(carry_);
+    return carry_;
+  }
+  return std::nullopt;
+}
+
+} // namespace gai
@@ -0,0 +1,87 @@
+#ifndef GAI_DECOMPRESS_H_
+#define GAI_DECOMPRESS_H_
+
+#include <array>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "input.h"
+
+namespace gai {
+
+enum class Compression { kNone, kGzip, kZstd };
+
+// Compressed data that is corrupt or truncated. It concerns a single file,
+// callers that go through many report it and go on with the next one.
+class DecompressError : public std::runtime_error {
+ public:
+  using std::runtime_error::runtime_error;
+};
+
+// Recognises gzip and zstd data by the magic bytes at its start.
+Compression DetectCompression(std::string_view head);
+
+// Lines of gzip or zstd compressed data. A reader thread decompresses into a
+// ring of blocks while the caller consumes lines from the block before, so
+// decompression and matching run on different cores. Concatenated gzip
+// members and zstd frames are read as one stream. A view stays valid until
+// the next call; a line crossing a block boundary is assembled in a separate
+// buffer. Lines kept for before context are copied, so blocks go back to the
+// reader as soon as they are consumed. Corrupt or truncated data throws
+// DecompressError from GetLine() once the lines before it have been handed
+// out.
+class DecompressingInput : public InputBase {
+ public:
+  static constexpr size_t kBlockSize = 1 << 20;
+  static constexpr size_t kBlocks = 4;
+
+  // `compressed` has to stay valid for the lifetime of the input.
+  DecompressingInput(std::string_view compressed, Compression compression);
+  ~DecompressingInput() override;
+  DecompressingInput(const DecompressingInput&) = delete;
+  DecompressingInput& operator=(const DecompressingInput&) = delete;
+
+  std::optional<std::string_view> GetLine() override;
+
+ private:
+  struct Block {
+    std::unique_ptr<char[]> data;
+    size_t size{0};
+  };
+
+  void Run();
+  // Reader side: waits for a free block, false when the consumer is gone.
+  Block* AcquireFree();
+  void Publish(bool last);
+  // Consumer side: waits for the next filled block, nullptr at the end.
+  Block* AcquireFilled();
+  void Release();
+
+  const std::string_view compressed_;
+  const Compression compression_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::array<Block, kBlocks> ring_;
+  size_t produced_{0};  // blocks filled by the reader
+  size_t consumed_{0};  // blocks given back by the consumer
+  bool finished_{false};
+  bool stop_{false};
+  std::string error_;
+
+  Block* current_{nullptr};
+  size_t pos_{0};
+  std::string carry_;
+  bool carried_{false};
+  std::thread reader_;
+};
+
+} // namespace gai
+
+#endif // GAI_DECOMPRESS_H_
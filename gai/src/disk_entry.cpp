@@ -0,0 +1,28 @@
+#include <fstream>
+#include <unistd.h>
+
+#include "disk_entry.h"
+
+namespace gai {
+
+namespace fs = std::filesystem;
+
+bool WriteFileAtomically(const fs::path& path, std::string_view data) {
+  // process and thread id keep the names of concurrent writers apart
+  std::string temporary = path.string();
+  temporary.append(".").append(std::to_string(::getpid()));
+  temporary.append(".").append(std::to_string(::gettid())).append(".tmp");
+  bool written = false;
+  {
+    std::ofstream file{temporary, std::ios::binary | std::ios::trunc};
+    file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    written = static_cast<bool>(file);
+  }
+
+  std::error_code ec;
+  if (written) fs::rename(temporary, path, ec);
+  if (!written || ec) fs::remove(temporary, ec);
+  return written && !ec;
+}
+
+} // namespace gai
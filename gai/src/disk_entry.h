@@ -0,0 +1,47 @@
+#ifndef GAI_DISK_ENTRY_H_
+#define GAI_DISK_ENTRY_H_
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+namespace gai {
+
+// Building blocks of the on-disk caches (pattern cache, line index): entries
+// are flat byte strings of fixed size values in host byte order, checked with
+// an FNV-1a hash and replaced as a whole.
+
+template <typename T>
+void AppendValue(std::string& out, const T& value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Reads a value from the front of `in` and moves past it, false if `in` is
+// too short.
+template <typename T>
+bool ReadValue(std::string_view& in, T& value) {
+  if (in.size() < sizeof(value)) return false;
+  std::memcpy(&value, in.data(), sizeof(value));
+  in.remove_prefix(sizeof(value));
+  return true;
+}
+
+// 64-bit FNV-1a of `data`, continuing from `hash` to chain several pieces.
+inline uint64_t Fnv1a(std::string_view data, uint64_t hash = 14695981039346656037ull) {
+  for (const char c : data) {
+    hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+  }
+  return hash;
+}
+
+// Writes `data` to a file private to the calling thread and renames it to
+// `path`, so concurrent writers, in this run or another, never leave a
+// partial entry behind. Best effort: returns false and leaves nothing behind
+// on errors.
+bool WriteFileAtomically(const std::filesystem::path& path, std::string_view data);
+
+} // namespace gai
+
+#endif // GAI_DISK_ENTRY_H_
@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "follow.h"
+#include "input.h"
+#include "simd.h"
+
+namespace gai {
+
+namespace fs = std::filesystem;
+
+// Appended data is read in pieces of this size, so a large backlog is
+// scanned in bounded memory.
+constexpr size_t kReadSize = 1 << 20;
+
+constexpr uint32_t kFileEvents = IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF;
+constexpr uint32_t kDirectoryEvents = IN_CREATE | IN_MOVED_TO;
+
+Follower::Follower(const std::vector<std::string>& paths, const Patterns& patterns, OutputSink& out)
+  : patterns_(patterns), out_(out) {
+  inotify_fd_ = ::inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+  if (inotify_fd_ < 0) {
+    throw std::runtime_error(std::string("Unable to initialise inotify: ") + std::strerror(errno));
+  }
+
+  files_.reserve(paths.size());
+  for (const std::string& path : paths) {
+    File& file = files_.emplace_back();
+    file.path = path;
+    file.range = patterns.range;
+    if (out_.HasContext()) {
+      file.input = std::make_unique<InputPieces>();
+      file.input->KeepPrevious(out_.Before());
+      file.printer = std::make_unique<ContextPrinter>(patterns.replacements, out_);
+    }
+
+    // the directory is watched for the file being created again after a
+    // rotation or for the first time
+    const fs::path parent = fs::path{path}.parent_path();
+    const std::string directory = parent.empty() ? std::string{"."} : parent.string();
+    const int wd = ::inotify_add_watch(inotify_fd_, directory.c_str(), kDirectoryEvents);
+    if (wd < 0) {
+      const std::string error = std::strerror(errno);
+      ::close(inotify_fd_);
+      throw std::runtime_error("Unable to watch directory " + directory + ": " + error);
+    }
+    directory_watches_[wd].push_back(files_.size() - 1);
+  }
+
+  for (File& file : files_) {
+    Open(file);
+    Drain(file);
+  }
+  out_.Flush();
+}
+
+Follower::~Follower() {
+  for (File& file : files_) Close(file);
+  ::close(inotify_fd_);
+}
+
+void Follower::Open(File& file) {
+  file.fd = ::open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (file.fd < 0) return;
+  struct stat info{};
+  if (::fstat(file.fd, &info) != 0) {
+    Close(file);
+    return;
+  }
+  file.dev = info.st_dev;
+  file.ino = info.st_ino;
+  file.offset = 0;
+  file.pending.clear();
+  file.wd = ::inotify_add_watch(inotify_fd_, file.path.c_str(), kFileEvents);
+}
+
+void Follower::Close(File& file) {
+  if (file.wd >= 0) ::inotify_rm_watch(inotify_fd_, file.wd);
+  if (file.fd >= 0) ::close(file.fd);
+  file.wd = -1;
+  file.fd = -1;
+}
+
+void Follower::ProcessLines(File& file, std::string_view lines) {
+  out_.SetSource(lines);
+  out_.SetFilename(file.path);
+  if (file.printer) {
+    file.input->Feed(lines);
+    ProcessWithContext(patterns_.filters, patterns_.excludes, patterns_.replacements, out_, file.range,
+                       file.input.get(), file.linenum, *file.printer);
+  } else {
+    ProcessBuffer(patterns_.filters, patterns_.excludes, patterns_.replacements, out_, file.range, lines,
+                  file.linenum);
+  }
+  file.linenum += CountNewlines(lines);
+  // the pending output points into the read buffer
+  out_.Flush();
+}
+
+void Follower::Drain(File& file) {
+  if (file.fd < 0) return;
+
+  struct stat info{};
+  if ((::fstat(file.fd, &info) == 0) && (info.st_size < file.offset)) {
+    // truncated in place, start over; what was written before is gone
+    file.offset = 0;
+    file.pending.clear();
+  }
+
+  while (true) {
+    // read behind the unfinished line, which grows in place until its newline
+    // arrives; only the bytes read are searched for it
+    const size_t kept = file.pending.size();
+    file.pending.resize(kept + kReadSize);
+    const ssize_t n = ::pread(file.fd, file.pending.data() + kept, kReadSize, file.offset);
+    file.pending.resize(kept + size_t(std::max<ssize_t>(n, 0)));
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    if (n == 0) return;
+    file.offset += n;
+
+    const void* newline = memrchr(file.pending.data() + kept, '\n', size_t(n));
+    if (!newline) continue;
+    const size_t length = static_cast<const char*>(newline) - file.pending.data() + 1;
+    ProcessLines(file, std::string_view{file.pending}.substr(0, length));
+    file.pending.erase(0, length);
+  }
+}
+
+void Follower::CheckRotation(File& file) {
+  struct stat info{};
+  // deleted and not created again yet, keep reading what is still open
+  if (::stat(file.path.c_str(), &info) != 0) return;
+  if ((file.fd >= 0) && (info.st_dev == file.dev) && (info.st_ino == file.ino)) return;
+
+  // whatever was written before the rotation is still read from the old file
+  Drain(file);
+  if (!file.pending.empty()) {
+    file.pending.push_back('\n');
+    ProcessLines(file, file.pending);
+    file.pending.clear();
+  }
+  Close(file);
+  Open(file);
+  Drain(file);
+}
+
+bool Follower::Step(int timeout_ms, int stop_fd) {
+  // poll() ignores a negative descriptor
+  pollfd pfds[2]{{inotify_fd_, POLLIN, 0}, {stop_fd, POLLIN, 0}};
+  const int ready = ::poll(pfds, 2, timeout_ms);
+  if (ready < 0) {
+    if (errno == EINTR) return true;
+    throw std::runtime_error(std::string("Unable to wait for inotify events: ") + std::strerror(errno));
+  }
+  if (pfds[1].revents & POLLIN) return false;
+  if (ready == 0) return true;
+
+  // changes are collected first so a burst of events scans each file once
+  std::vector<bool> modified(files_.size(), false);
+  std::vector<bool> moved(files_.size(), false);
+  alignas(inotify_event) char events[64 << 10];
+  while (true) {
+    const ssize_t n = ::read(inotify_fd_, events, sizeof(events));
+    if (n <= 0) break;
+    for (ssize_t offset = 0; offset < n;) {
+      const auto* event = reinterpret_cast<const inotify_event*>(events + offset);
+      offset += ssize_t(sizeof(inotify_event) + event->len);
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        modified.assign(files_.size(), true);
+        moved.assign(files_.size(), true);
+        continue;
+      }
+      if (const auto it = directory_watches_.find(event->wd); it != directory_watches_.end()) {
+        const std::string_view name = (event->len > 0) ? std::string_view{event->name} : std::string_view{};
+        for (const size_t k : it->second) {
+          if (fs::path{files_[k].path}.filename().string() == name) moved[k] = true;
+        }
+        continue;
+      }
+      for (size_t k = 0; k < files_.size(); ++k) {
+        if ((files_[k].wd != event->wd) || (files_[k].fd < 0)) continue;
+        modified[k] = true;
+        if (event->mask & (IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)) moved[k] = true;
+      }
+    }
+  }
+
+  for (size_t k = 0; k < files_.size(); ++k) {
+    if (modified[k]) Drain(files_[k]);
+    if (moved[k]) CheckRotation(files_[k]);
+  }
+  out_.Flush();
+  return true;
+}
+
+} // namespace gai
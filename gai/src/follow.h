@@ -0,0 +1,74 @@
+#ifndef GAI_FOLLOW_H_
+#define GAI_FOLLOW_H_
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+
+#include "operation.h"
+#include "output.h"
+#include "process.h"
+
+namespace gai {
+
+// Follows files like `tail -F`: their current contents are scanned first,
+// after that only appended bytes. Wake ups come from inotify, nothing is
+// polled, so idle files cost no CPU.
+//
+// A file is followed by name. When it is found shorter than what was read
+// (truncated in place) it is read again from the start; when it is renamed
+// or deleted the old descriptor is drained and the file created under the
+// same name is followed from its start. Line numbers, range state and
+// context (-A, -B) carry on across appends and rotations. An unterminated
+// last line is held back until its newline arrives (or the file is rotated
+// away). Files that do not exist yet are picked up once they are created.
+class Follower {
+ public:
+  Follower(const std::vector<std::string>& paths, const Patterns& patterns, OutputSink& out);
+  ~Follower();
+  Follower(const Follower&) = delete;
+  Follower& operator=(const Follower&) = delete;
+
+  // Waits up to `timeout_ms` (-1 without limit) for changes and scans what
+  // is new in the followed files. Output is flushed before returning.
+  // Returns false, without scanning, once `stop_fd` is readable (a signalfd
+  // or a pipe that asks to stop following).
+  bool Step(int timeout_ms, int stop_fd = -1);
+
+ private:
+  struct File {
+    std::string path;
+    int fd{-1};
+    int wd{-1};
+    dev_t dev{0};
+    ino_t ino{0};
+    off_t offset{0};
+    size_t linenum{0};
+    std::string pending;  // bytes after the last newline read so far
+    std::optional<Range> range;
+    // with context, what carries it from one append to the next
+    std::unique_ptr<InputPieces> input;
+    std::unique_ptr<ContextPrinter> printer;
+  };
+
+  void Open(File& file);
+  void Close(File& file);
+  // Scans the bytes appended since the last call.
+  void Drain(File& file);
+  // Reopens `file` when its name now refers to another inode.
+  void CheckRotation(File& file);
+  void ProcessLines(File& file, std::string_view lines);
+
+  const Patterns& patterns_;
+  OutputSink& out_;
+  int inotify_fd_{-1};
+  std::vector<File> files_;
+  std::unordered_map<int, std::vector<size_t>> directory_watches_;
+};
+
+} // namespace gai
+
+#endif // GAI_FOLLOW_H_
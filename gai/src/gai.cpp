@@ -1,73 +1,92 @@
-#include <functional>
-#include <mio/mmap.hpp>
+#include <charconv>
+#include <exception>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <csignal>
+#include <sys/signalfd.h>
+#include <thread>
+#include <unistd.h>
 
 #include "args.h"
+#include "batch_read.h"
+#include "decompress.h"
+#include "follow.h"
+#include "format.h"
 #include "operation.h"
 #include "input.h"
+#include "line_index.h"
+#include "loader.h"
+#include "output.h"
+#include "pattern_cache.h"
+#include "process.h"
+#include "search.h"
+#include "simd.h"
+#include "stats.h"
+#include "walk.h"
 #include "printx.hpp"
 
 constexpr const char* kVersion = "25.10.1";
 
 namespace gai {
-using OutputFunc = std::function<void(std::string_view, size_t)>;
-
-static void Process(const std::vector<gai::Pcre2Regex>& filters,
-                    const std::vector<gai::Pcre2Regex>& excludes,
-                    const std::vector<gai::Pcre2Substitution>& replacements,
-                    const OutputFunc& out_fn,
-                    std::optional<gai::Range>& range, InputBase* const input) {
-  thread_local std::string replacement_buffer(1024, ' ');
-  thread_local std::string replacement_line(1024, ' ');
-  size_t linenum = 0;
-  while (std::optional<std::string_view> line_opt = input->GetLine()) {
-    ++linenum;
-    std::string_view& line = line_opt.value();
-    if (range) {
-      if (!range->IsStartReached(line, linenum)) continue;
-      if (range->IsEndReached(line, linenum)) continue;
-    }
 
-    bool match = std::any_of(filters.begin(), filters.end(),
-                             [&line](const auto& r) { return Find(r, line); });
-    if (!filters.empty() && !match) {
-      continue;
-    }
+// Prints how a pattern will be evaluated: JIT, whole buffer search and the
+// literal prefilter that rules out lines before PCRE2 runs.
+static void Explain(std::string_view kind, const Pcre2Compiled& re) {
+  rostd::fprintf<"%s\t%s\tjit=%s\tbuffer-search=%s\tprefilter=%s\n">(
+    stderr, kind, re.pattern, re.jitted ? "yes" : "no", re.buffer_searchable ? "yes" : "no",
+    re.literal.empty() ? std::string_view{"-"} : std::string_view{re.literal});
+}
 
-    match = std::any_of(excludes.begin(), excludes.end(),
-                        [&line](const auto& r) { return Find(r, line); });
-    if (!excludes.empty() && match) {
-      continue;
-    }
+static void Explain(std::string_view kind, std::string_view combined_kind, const Pcre2PatternSet& set) {
+  for (size_t k = 0; k < set.matchers.size(); ++k) {
+    Explain((set.ids[k] == Pcre2PatternSet::kCombined) ? combined_kind : kind, set.matchers[k].re);
+  }
+}
 
-    if (!replacements.empty()) {
-      replacement_line.assign(line);
-      for (const Pcre2Substitution& r : replacements) {    
-        std::string_view replace = Substitute(r, replacement_line, replacement_buffer);
-        replacement_line.assign(replace);
-      }
-      out_fn(replacement_line, linenum);
-    } else {
-      out_fn(line, linenum);
-    }
+static void Explain(const Patterns& patterns) {
+  Explain("filter", "filter-combined", patterns.filters);
+  Explain("exclude", "exclude-combined", patterns.excludes);
+  for (const Pcre2Substitution& r : patterns.replacements) Explain("replace", r.re);
+  if (patterns.range) {
+    if (const auto* start = std::get_if<SharedRegex>(&patterns.range->start)) Explain("range-start", (*start)->re);
+    if (const auto* end = std::get_if<SharedRegex>(&patterns.range->end)) Explain("range-end", (*end)->re);
   }
 }
 
-static void NormalPrint(std::string_view content, size_t linenum) {
-  std::ignore = linenum;
-  rostd::printf<"%s\n">(content);
+// Registers every pattern with --stats, under the names --explain uses; the
+// members of combined programs under their own text.
+static void TrackPatterns(const Patterns& patterns) {
+  TrackPatternSet("filter", patterns.filters);
+  TrackPatternSet("exclude", patterns.excludes);
+  for (const Pcre2Substitution& r : patterns.replacements) TrackPattern("replace", r.re);
+  if (patterns.range) {
+    if (const auto* start = std::get_if<SharedRegex>(&patterns.range->start)) TrackPattern("range-start", (*start)->re);
+    if (const auto* end = std::get_if<SharedRegex>(&patterns.range->end)) TrackPattern("range-end", (*end)->re);
+  }
 }
 
-static gai::OutputFunc MakeOutputFunc(bool verbose, std::string_view delimiter,
-                                      std::string_view filename = {}) {
-  if (!verbose) return gai::NormalPrint;
-  if (filename.empty()) {
-    return [delimiter](std::string_view c, size_t k) {
-      rostd::printf<"%zu%s%s\n">(k, delimiter, c);
-    };
+// Appends the non-empty lines of every file in `paths` to `patterns`. The
+// file contents are kept in `storage` because the patterns point into them.
+static void ReadPatternFiles(const std::vector<std::string_view>& paths, std::list<std::string>& storage,
+                             std::vector<std::string_view>& patterns) {
+  for (const std::string_view& path : paths) {
+    std::ifstream file{std::string{path}, std::ios::binary};
+    if (!file) {
+      std::string_view error_msg = common::FormatIntoStringView<"Unable to read pattern file.\nFile: %s\n">(path);
+      throw std::runtime_error(std::string(error_msg));
+    }
+    const std::string& contents = storage.emplace_back(std::istreambuf_iterator<char>{file},
+                                                       std::istreambuf_iterator<char>{});
+    std::string_view rest{contents};
+    while (!rest.empty()) {
+      const size_t n = std::min(rest.find('\n'), rest.size());
+      std::string_view line = rest.substr(0, n);
+      rest.remove_prefix(std::min(n + 1, rest.size()));
+      if (line.ends_with('\r')) line.remove_suffix(1);
+      if (!line.empty()) patterns.push_back(line);
+    }
   }
-  return [filename, delimiter](std::string_view c, size_t k) {
-    rostd::printf<"%s%s%zu%s%s\n">(filename, delimiter, k, delimiter, c);
-  };
 }
 
 } // namespace gai
@@ -81,11 +100,67 @@ Usage: gai [options]
 Options:
   -f, --filter              List of filters (default: [])
   -e, --exclude             List of exclusions (default: [])
+      --filter-file         Files with one filter per line (default: [])
+      --exclude-file        Files with one exclusion per line (default: [])
   -r, --replace             List of replacements (default: [])
-      --range               Optional filter range (default: )
+      --range               Optional filter range. Lines in front of a line number start are
+                            skipped with a vectorised newline count and reading stops at a line
+                            number end (default: )
+  -A, --after-context       Lines to print after each match (default: 0)
+  -B, --before-context      Lines to print before each match (default: 0)
+  -C, --context             Lines to print before and after each match; -A and -B take precedence.
+                            Context lines get replacements too, stay inside --range, are marked
+                            with '-' in verbose output and non-adjacent groups are separated by
+                            '--' (default: 0)
+  -c, --count               Print the number of matching lines of every file instead of the lines
+                            (default: false)
+  -l, --files-with-matches  Print only the names of files with a match, each file is left at its
+                            first match (default: false)
+  -o, --only-matching       Print every match of the filters instead of the line it is on, or
+                            the capture groups given after the flag (e.g. `-o 1 3`) joined by the
+                            delimiter. Matches are printed straight from the input, without
+                            copies. Cannot be combined with -r (default: false)
+  -m, --max-count           Stop reading a file after this many matching lines, 0 for no limit
+                            (default: 0)
       --utf                 Enable UTF (default: false)
+      --utf-invalid         What --utf does with input that is not valid UTF-8: keep them as
+                            `bytes` that never match while the text around them does, `replace`
+                            bytes that do not start a valid sequence with U+FFFD (printed lines
+                            change), or `skip` the lines that hold them. With replace and skip
+                            input is validated once, ahead of matching, instead of on every
+                            match call (default: bytes)
       --no-jit              Disable JIT compilation of expressions (default: false)
-      --files               List of Input files. If not given STDIN will be used (default: [])
+      --files               List of Input files. If not given STDIN will be used. Directories are
+                            searched recursively, skipping hidden entries. gzip and zstd
+                            compressed files are decompressed (default: [])
+  -F, --follow              Keep following --files after scanning them, like `tail -F`: appended
+                            lines are matched as they arrive, truncated and rotated files are
+                            reopened. Takes plain files only (default: false)
+      --ignore              Globs of files and directories to skip while searching directories,
+                            matched against names and paths (default: [])
+  -j, --threads             Number of worker threads, 0 uses all cores. Files are processed in
+                            parallel and large files are split into chunks. Output is the same
+                            as with a single thread (default: 1)
+      --no-io-uring         Read small files with plain read(2) instead of batched io_uring
+                            submissions (default: false)
+      --populate            Fault large files in completely when they are mapped (MAP_POPULATE)
+                            instead of relying on read ahead (default: false)
+      --huge-pages          Ask for transparent huge pages on mapped files (default: false)
+      --cache-dir           Directory in which compiled patterns are cached across runs. Only the
+                            JIT step is repeated for cached patterns (default: disabled)
+      --line-index          Directory in which line indexes of plain files of 16MiB and more are
+                            kept across runs, one entry every 65536 lines. --range seeks to line
+                            numbers through them and -j splits files at their entries without
+                            counting lines. Files that only grew are indexed from where the last
+                            run stopped (default: disabled)
+      --explain             Print how each pattern is matched (JIT, buffer search, literal
+                            prefilter) to stderr (default: false)
+      --stats               Print to stderr at exit: evaluations, hits and time of every pattern,
+                            bytes and lines read, time spent reading, matching and writing
+                            (summed over threads) and the overall throughput. Pattern times
+                            are estimated from one evaluation in 64; patterns merged into one
+                            combined program share its evaluations and time, noted as
+                            combined=N (default: false)
   -v, --verbose             Verbose print output (default: false)
   -d, --delim               Delimiter to use for verbose printing (default - ':')
   -h, --help                Show this help message
@@ -108,34 +183,174 @@ Options:
     const bool verbose = cli.Has("--verbose") || cli.Has("-v");
     std::string_view delimiter = cli.Value({"-d", "--delim"}).value_or(":");
 
-    const VecStringView filter_exprs  = cli.MultiValue({"-f", "--filter"}, true).value_or(VecStringView{});
-    const VecStringView exclude_exprs = cli.MultiValue({"-e", "--exclude"}, true).value_or(VecStringView{});
+    VecStringView filter_exprs  = cli.MultiValue({"-f", "--filter"}, true).value_or(VecStringView{});
+    VecStringView exclude_exprs = cli.MultiValue({"-e", "--exclude"}, true).value_or(VecStringView{});
+    std::list<std::string> pattern_files;
+    gai::ReadPatternFiles(cli.MultiValue({"--filter-file"}, true).value_or(VecStringView{}), pattern_files, filter_exprs);
+    gai::ReadPatternFiles(cli.MultiValue({"--exclude-file"}, true).value_or(VecStringView{}), pattern_files, exclude_exprs);
     const VecStringView replace_exprs = cli.MultiValue({"-r", "--replace"}, true).value_or(VecStringView{});
     const std::string_view range_expr = cli.Value({"--range"}).value_or("");
 
-    const std::vector<gai::Pcre2Regex> filters = gai::ParseFilters(filter_exprs, jit, utf);
-    const std::vector<gai::Pcre2Regex> excludes = gai::ParseFilters(exclude_exprs, jit, utf);
-    const std::vector<gai::Pcre2Substitution> replacements = gai::ParseSubstitutions(replace_exprs, jit, utf);
-    std::optional<gai::Range> range = gai::ParseRange(range_expr, jit, utf);
+    std::optional<gai::InvalidUtf8> invalid_utf8;
+    if (utf) {
+      const std::string_view invalid = cli.Value({"--utf-invalid"}).value_or("bytes");
+      if (invalid == "bytes") {
+        invalid_utf8 = gai::InvalidUtf8::kBytes;
+      } else if (invalid == "replace") {
+        invalid_utf8 = gai::InvalidUtf8::kReplace;
+      } else if (invalid == "skip") {
+        invalid_utf8 = gai::InvalidUtf8::kSkip;
+      } else {
+        std::string_view error_msg = common::FormatIntoStringView<"Unknown --utf-invalid policy: %s\n">(invalid);
+        throw std::runtime_error(std::string(error_msg));
+      }
+    }
+    // on before compiling, so the time spent there counts towards the total
+    if (cli.Has("--stats")) gai::EnableStats();
+    if (const auto cache_dir = cli.Value({"--cache-dir"})) gai::EnablePatternCache(*cache_dir);
+    if (const auto index_dir = cli.Value({"--line-index"})) gai::EnableLineIndex(*index_dir);
+    gai::Patterns patterns{gai::ParseFilters(filter_exprs, jit, utf, invalid_utf8),
+                           gai::ParseFilters(exclude_exprs, jit, utf, invalid_utf8),
+                           gai::ParseSubstitutions(replace_exprs, jit, utf, invalid_utf8),
+                           gai::ParseRange(range_expr, jit, utf, invalid_utf8)};
+    if (cli.Has("--explain")) gai::Explain(patterns);
+    if (cli.Has("--stats")) gai::TrackPatterns(patterns);
     const VecStringView files = cli.MultiValue({"--files"}, true).value_or(VecStringView{});
+    const gai::WalkOptions walk_options{cli.MultiValue({"--ignore"}, true).value_or(VecStringView{})};
+    const bool use_io_uring = !cli.Has("--no-io-uring");
+    common::LoadOptions load_options;
+    load_options.populate = cli.Has("--populate");
+    load_options.huge_pages = cli.Has("--huge-pages");
+
+    gai::OutputOptions output{verbose, delimiter};
+    if (cli.Has("-c") || cli.Has("--count")) output.mode = gai::OutputSink::Mode::kCount;
+    if (cli.Has("-l") || cli.Has("--files-with-matches")) output.mode = gai::OutputSink::Mode::kFilesWithMatches;
+    output.max_count = std::stoul(std::string{cli.Value({"-m", "--max-count"}).value_or("0")});
+    if (cli.Has("-o") || cli.Has("--only-matching")) {
+      if (patterns.filters.empty()) throw std::runtime_error("-o prints what --filter matches, it needs a filter");
+      if (!patterns.replacements.empty()) throw std::runtime_error("-o prints matches as they are, not with -r");
+      const auto groups = cli.MultiValue({"-o", "--only-matching"}, true);
+      // groups no filter has would only ever print empty fields
+      size_t max_group = 0;
+      for (const gai::Pcre2Regex& filter : patterns.filters.matchers) {
+        max_group = std::max<size_t>(max_group, filter.ovector_pairs - 1);
+      }
+      for (const std::string_view& group : groups.value_or(VecStringView{"0"})) {
+        output.groups.push_back(std::stoul(std::string{group}));
+        if (output.groups.back() > max_group) {
+          std::string_view error_msg = common::FormatIntoStringView<"No filter has capture group %s\n">(group);
+          throw std::runtime_error(std::string(error_msg));
+        }
+      }
+    }
+    // context only goes with printed lines
+    if ((output.mode == gai::OutputSink::Mode::kLines) && output.groups.empty()) {
+      const std::string context = std::string{cli.Value({"-C", "--context"}).value_or("0")};
+      output.before_context = std::stoul(std::string{cli.Value({"-B", "--before-context"}).value_or(context)});
+      output.after_context = std::stoul(std::string{cli.Value({"-A", "--after-context"}).value_or(context)});
+    }
+    // a file that is left early should not be read ahead in full
+    load_options.read_ahead = (output.mode != gai::OutputSink::Mode::kFilesWithMatches) && (output.max_count == 0);
 
-    if (files.empty()) {
-      const gai::OutputFunc fn = gai::MakeOutputFunc(verbose, delimiter);
+    size_t threads = std::stoul(std::string{cli.Value({"-j", "--threads"}).value_or("1")});
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+    if (cli.Has("-F") || cli.Has("--follow")) {
+      if (files.empty()) throw std::runtime_error("--follow needs --files");
+      if (output.mode != gai::OutputSink::Mode::kLines) throw std::runtime_error("--follow prints lines, not counts");
+      std::vector<std::string> paths;
+      for (const std::string_view& f : files) {
+        paths.emplace_back(f);
+        if (gai::IsDirectory(paths.back())) throw std::runtime_error("--follow takes files, not directories");
+      }
+      gai::OutputSink sink(STDOUT_FILENO, verbose, delimiter);
+      output.Configure(sink);
+      // SIGINT and SIGTERM end following through a signalfd instead of
+      // killing the process, so the output is flushed and --stats reported
+      sigset_t stop_signals;
+      sigemptyset(&stop_signals);
+      sigaddset(&stop_signals, SIGINT);
+      sigaddset(&stop_signals, SIGTERM);
+      ::sigprocmask(SIG_BLOCK, &stop_signals, nullptr);
+      const int stop_fd = ::signalfd(-1, &stop_signals, SFD_CLOEXEC);
+      if (stop_fd < 0) throw std::runtime_error("Unable to create a signalfd for --follow");
+      {
+        gai::Follower follower(paths, patterns, sink);
+        while (follower.Step(-1, stop_fd)) {}
+      }
+      ::close(stop_fd);
+    } else if (files.empty()) {
+      gai::OutputSink sink(STDOUT_FILENO, verbose, delimiter);
+      output.Configure(sink);
       gai::InputStream stream;
-      gai::Process(filters, excludes, replacements, fn, range, &stream);
-    } else {
+      gai::Process(patterns.filters, patterns.excludes, patterns.replacements, sink, patterns.range, &stream);
+      sink.EndFile();
+      sink.Flush();
+    } else if (threads <= 1) {
+      gai::OutputSink sink(STDOUT_FILENO, verbose, delimiter);
+      output.Configure(sink);
+      auto process_contents = [&](const std::string& path, std::string_view contents,
+                                  const gai::LineIndex* index = nullptr) {
+        if (patterns.range) patterns.range->Reset();
+        sink.SetSource(contents);
+        sink.SetFilename(path);
+        if (index) {
+          const gai::RangeSlice slice = gai::SliceToRange(patterns.range, contents, 0, index);
+          gai::ProcessBuffer(patterns.filters, patterns.excludes, patterns.replacements, sink, patterns.range,
+                             slice.buffer, slice.linenum);
+        } else {
+          gai::ProcessFileContents(patterns, sink, patterns.range, path, contents);
+        }
+        sink.EndFile();
+      };
+      // small files are read a batch at a time, larger ones are mapped by the
+      // prefetcher, which loads the next one while the current one is scanned
+      gai::BatchReader reader(use_io_uring);
+      common::FilePrefetcher prefetcher(load_options);
+      std::vector<std::string> batch;
+      auto process_batch = [&]() {
+        const std::vector<gai::BatchedFile>& read = reader.Read(batch);
+        for (size_t k = 0; k < read.size(); ++k) {
+          if (read[k].deferred) prefetcher.Push(batch[k]);
+        }
+        for (size_t k = 0; k < read.size(); ++k) {
+          if (read[k].ok) process_contents(batch[k], read[k].contents);
+          if (!read[k].deferred) continue;
+          const common::PrefetchedFile loaded = [&]() {
+            gai::StageTimer timer(gai::Stage::kInput);
+            return prefetcher.Pop();
+          }();
+          if (loaded.ec) continue;
+          std::optional<gai::LineIndex> index;
+          if (gai::DetectCompression(loaded.file.View()) == gai::Compression::kNone) {
+            gai::StageTimer timer(gai::Stage::kInput);
+            index = gai::GetLineIndex(loaded.path, loaded.file.View());
+          }
+          process_contents(loaded.path, loaded.file.View(), index ? &*index : nullptr);
+          // the pending output points into the loaded file
+          sink.Flush();
+        }
+        // the pending output points into the reader's buffers
+        sink.Flush();
+        batch.clear();
+      };
+      auto add_file = [&](std::string path) {
+        batch.push_back(std::move(path));
+        if (batch.size() == gai::BatchReader::kMaxBatch) process_batch();
+      };
       for (const std::string_view& f : files) {
-        mio::mmap_source contents;
-        std::error_code ec;
-        contents.map(f, ec);
-        if (ec) continue;
-
-        gai::InputMemMappedFile mmap_stream(contents.begin(), contents.end());
-        if (range) range->Reset();
-        const gai::OutputFunc fn = gai::MakeOutputFunc(verbose, delimiter, f);
-        gai::Process(filters, excludes, replacements, fn, range, &mmap_stream);
+        std::string path{f};
+        if (gai::IsDirectory(path)) {
+          gai::Walk(path, walk_options, add_file);
+        } else {
+          add_file(std::move(path));
+        }
       }
+      if (!batch.empty()) process_batch();
+    } else {
+      gai::ProcessFilesParallel(files, walk_options, threads, use_io_uring, load_options, patterns, output);
     }
+    gai::ReportStats(stderr);
   } catch (const std::exception& ex) {
     rostd::printf<"Exception raised!!\nException: %s\n">(ex.what());
     return EXIT_FAILURE;
@@ -1,16 +1,122 @@
-#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
 #include "input.h"
+#include "simd.h"
+#include "stats.h"
 
 namespace gai {
 
+void LineHistory::Resize(size_t lines) {
+  slots_.assign((lines > 0) ? lines + 1 : 0, std::string_view{});
+  copies_.assign(copy_ ? slots_.size() : 0, std::string{});
+  head_ = 0;
+  count_ = 0;
+}
+
+void LineHistory::Record(std::string_view line) {
+  head_ = (head_ + 1) % slots_.size();
+  count_ = std::min(count_ + 1, slots_.size());
+  if (copy_) {
+    copies_[head_].assign(line);
+    line = copies_[head_];
+  }
+  slots_[head_] = line;
+}
+
+const char* LineHistory::Oldest() const {
+  if (copy_ || (count_ == 0)) return nullptr;
+  // the oldest slot is dropped by the next Record()
+  const size_t needed = std::min(count_, slots_.size() - 1);
+  return slots_[(head_ + slots_.size() + 1 - needed) % slots_.size()].data();
+}
+
+void LineHistory::Rebase(const char* from, const char* to, const char* new_from) {
+  for (std::string_view& line : slots_) {
+    if ((line.data() >= from) && (line.data() < to)) line = {new_from + (line.data() - from), line.size()};
+  }
+}
+
+InputStream::InputStream(int fd, size_t block_size) : fd_{fd}, block_(std::max<size_t>(block_size, 1)) {}
+
 std::optional<std::string_view> InputStream::GetLine() {
-  if (std::getline(std::cin, line_)) return std::string_view{line_};
+  while (true) {
+    const char* start = block_.data() + begin_;
+    const char* newline_ptr = static_cast<const char*>(
+      std::memchr(start + scanned_, '\n', end_ - begin_ - scanned_)
+    );
+    if (newline_ptr) {
+      std::string_view line(start, newline_ptr - start);
+      begin_ += line.size() + 1;
+      scanned_ = 0;
+      history_.Advance(line);
+      return line;
+    }
+    scanned_ = end_ - begin_;
+    if (!Refill()) break;
+  }
+
+  // handle last line without newline
+  if (begin_ != end_) {
+    std::string_view line(block_.data() + begin_, end_ - begin_);
+    begin_ = end_;
+    scanned_ = 0;
+    history_.Advance(line);
+    return line;
+  }
   return std::nullopt;
 }
 
+bool InputStream::Refill() {
+  if (eof_) return false;
+
+  // lines kept for before context move along with the unfinished one
+  size_t keep = begin_;
+  if (const char* oldest = history_.Oldest()) keep = std::min<size_t>(keep, oldest - block_.data());
+  if (keep > 0) {
+    char* const data = block_.data();
+    std::memmove(data, data + keep, end_ - keep);
+    history_.Rebase(data + keep, data + end_, data);
+    end_ -= keep;
+    begin_ -= keep;
+  }
+  if (end_ == block_.size()) {
+    std::vector<char> grown(block_.size() * 2);
+    std::memcpy(grown.data(), block_.data(), end_);
+    history_.Rebase(block_.data(), block_.data() + end_, grown.data());
+    block_.swap(grown);
+  }
+
+  StageTimer timer(Stage::kInput);
+  while (true) {
+    const ssize_t n = ::read(fd_, block_.data() + end_, block_.size() - end_);
+    if (n > 0) {
+      end_ += static_cast<size_t>(n);
+      CountInput(static_cast<size_t>(n), 0);
+      return true;
+    }
+    if (n == 0) break;
+    if (errno == EINTR) continue;
+    throw std::runtime_error(std::string("Unable to read input: ") + std::strerror(errno));
+  }
+  eof_ = true;
+  return false;
+}
+
+size_t InputBase::GetLines(std::string_view* lines, size_t max) {
+  if (max == 0) return 0;
+  const std::optional<std::string_view> line = GetLine();
+  if (!line) return 0;
+  lines[0] = *line;
+  return 1;
+}
+
 InputMemMappedFile::InputMemMappedFile(const char* begin, const char* end) : ptr_{begin}, end_{end} {}
 
 std::optional<std::string_view> InputMemMappedFile::GetLine() {
+  batch_count_ = 0;
   if (ptr_ >= end_) return std::nullopt;
 
   const char* newline_ptr = static_cast<const char*>(
@@ -20,6 +126,7 @@ std::optional<std::string_view> InputMemMappedFile::GetLine() {
   if (newline_ptr) {
     std::string_view line(ptr_, newline_ptr - ptr_);
     ptr_ = newline_ptr + 1; // advance past newline
+    history_.Advance(line);
     return line;
   }
 
@@ -27,9 +134,65 @@ std::optional<std::string_view> InputMemMappedFile::GetLine() {
   if (ptr_ != end_) {
     std::string_view line(ptr_, end_ - ptr_);
     ptr_ = end_;
+    history_.Advance(line);
     return line;
   }
   return std::nullopt;
 }
 
+size_t InputMemMappedFile::GetLines(std::string_view* lines, size_t max) {
+  if (history_.IsRecording()) return InputBase::GetLines(lines, max);
+  if ((ptr_ >= end_) || (max == 0)) return 0;
+
+  newlines_.resize(std::max(newlines_.size(), max));
+  const size_t found = IndexNewlines({ptr_, static_cast<size_t>(end_ - ptr_)}, newlines_.data(), max);
+  batch_begin_ = ptr_;
+  size_t count = 0;
+  for (; count < found; ++count) {
+    const char* newline_ptr = batch_begin_ + newlines_[count];
+    lines[count] = std::string_view(ptr_, newline_ptr - ptr_);
+    ptr_ = newline_ptr + 1;
+  }
+  // every newline was found, what follows the last one is the last line
+  if ((count < max) && (ptr_ < end_)) {
+    lines[count++] = std::string_view(ptr_, end_ - ptr_);
+    ptr_ = end_;
+  }
+  batch_count_ = count;
+  return count;
+}
+
+void InputMemMappedFile::Unread(size_t lines) {
+  if ((lines == 0) || (lines > batch_count_)) return;
+  batch_count_ -= lines;
+  ptr_ = (batch_count_ == 0) ? batch_begin_ : batch_begin_ + newlines_[batch_count_ - 1] + 1;
+}
+
+std::optional<std::string_view> InputPieces::GetLine() {
+  if (rest_.empty()) return std::nullopt;
+  const size_t newline = rest_.find('\n');
+  const size_t length = (newline == std::string_view::npos) ? rest_.size() : newline;
+  const std::string_view line = rest_.substr(0, length);
+  rest_.remove_prefix(std::min(length + 1, rest_.size()));
+  history_.Advance(line);
+  return line;
+}
+
+std::vector<std::string_view> SplitIntoChunks(std::string_view content, size_t chunk_size) {
+  std::vector<std::string_view> out;
+  chunk_size = std::max<size_t>(chunk_size, 1);
+  while (!content.empty()) {
+    size_t n = content.size();
+    if (chunk_size < n) {
+      const char* newline_ptr = static_cast<const char*>(
+        std::memchr(content.data() + chunk_size - 1, '\n', n - chunk_size + 1)
+      );
+      if (newline_ptr) n = newline_ptr - content.data() + 1;
+    }
+    out.push_back(content.substr(0, n));
+    content.remove_prefix(n);
+  }
+  return out;
+}
+
 } // namespace gai
@@ -4,26 +4,102 @@
 #include <string_view>
 #include <string>
 #include <optional>
+#include <vector>
 #include <mio/mmap.hpp>
 
 namespace gai {
 
+// The last lines an input handed out, for before context (-B). Views are kept
+// as they are; an input that reuses its buffer either keeps the lines in it
+// and moves the views along (see Oldest and Rebase) or has them copied.
+class LineHistory {
+ public:
+  explicit LineHistory(bool copy = false) : copy_{copy} {}
+
+  // Keeps `lines` lines before the current one, 0 turns recording off.
+  void Resize(size_t lines);
+  // Records `line` as the current line.
+  void Advance(std::string_view line) {
+    if (!slots_.empty()) Record(line);
+  }
+  bool IsRecording() const { return !slots_.empty(); }
+  // Lines recorded before the current one.
+  size_t Size() const { return (count_ > 0) ? count_ - 1 : 0; }
+  // The line `k` lines before the current one, 1 <= k <= Size().
+  std::string_view Get(size_t k) const { return slots_[(head_ + slots_.size() - k) % slots_.size()]; }
+  // Start of the oldest line that is still needed once the next line is
+  // recorded, nullptr when nothing is kept.
+  const char* Oldest() const;
+  // Moves the views lying in [from, to) so they start at `new_from`.
+  void Rebase(const char* from, const char* to, const char* new_from);
+
+ private:
+  void Record(std::string_view line);
+
+  bool copy_{false};
+  std::vector<std::string_view> slots_;  // the current line and those before it
+  std::vector<std::string> copies_;
+  size_t head_{0};  // slot of the current line
+  size_t count_{0};
+};
+
 class InputBase {
  public:
   virtual ~InputBase() = default;
   virtual std::optional<std::string_view> GetLine() = 0;
+  // Hands out up to `max` lines at once into `lines` and returns how many,
+  // 0 at the end; the views stay valid until the next call. The lines of a
+  // batch follow each other in one buffer, with only their line ends in
+  // between. By default this is one GetLine(), inputs that can do better
+  // hand out whole batches.
+  virtual size_t GetLines(std::string_view* lines, size_t max);
+  // Gives back the last `lines` lines of the last GetLines() call, they are
+  // handed out again next. Lets a reader stop in the middle of a batch.
+  virtual void Unread(size_t lines) {}
+
+  // Keeps the `lines` lines before the current one readable through
+  // Previous(), for before context.
+  void KeepPrevious(size_t lines) { history_.Resize(lines); }
+  // The line handed out `k` lines before the current one, valid until the
+  // next GetLine().
+  std::string_view Previous(size_t k) const { return history_.Get(k); }
+  size_t PreviousCount() const { return history_.Size(); }
+
+ protected:
+  explicit InputBase(bool copy_history = false) : history_{copy_history} {}
+
+  LineHistory history_;
 };
 
+// Reads a file descriptor (stdin by default) with read(2) into one reusable
+// block and hands out views into it; a view stays valid until the next call.
+// The unfinished line at the end of a block is moved to the front before the
+// next read. A line that fills the whole block doubles it, so long lines cost
+// amortised linear time. Lines kept for before context stay in the block, so
+// they are never copied.
 class InputStream : public InputBase {
  public:
-  InputStream() = default;
-  ~InputStream() = default;
+  static constexpr size_t kDefaultBlockSize = 1 << 20;
+
+  explicit InputStream(int fd = 0, size_t block_size = kDefaultBlockSize);
+  ~InputStream() override = default;
 
   std::optional<std::string_view> GetLine() override;
  private:
-   std::string line_;
+  // Reads more data after the unfinished line, false once the input is exhausted.
+  bool Refill();
+
+  int fd_{0};
+  std::vector<char> block_;
+  size_t begin_{0};  // start of the unfinished line
+  size_t scanned_{0};  // bytes after begin_ known to hold no newline
+  size_t end_{0};  // end of valid data
+  bool eof_{false};
 };
 
+// Lines of a buffer that stays valid (a mapped file). GetLines() finds the
+// newlines of a whole batch with IndexNewlines(); while lines are kept for
+// before context it goes line by line.
 class InputMemMappedFile : public InputBase {
  public:
   InputMemMappedFile() = delete;
@@ -31,11 +107,37 @@ class InputMemMappedFile : public InputBase {
   ~InputMemMappedFile() override = default;
 
   std::optional<std::string_view> GetLine() override;
+  size_t GetLines(std::string_view* lines, size_t max) override;
+  void Unread(size_t lines) override;
  private:
   const char* ptr_{nullptr};
   const char* end_{nullptr};
+  // the last batch: where it started, its newlines relative to that and its size
+  const char* batch_begin_{nullptr};
+  std::vector<size_t> newlines_;
+  size_t batch_count_{0};
 };
 
+// Lines of buffers handed in one after the other, like the parts appended to
+// a followed file. Each buffer ends with a newline or the stream. Lines kept
+// for before context are copied, so they outlive the buffer they came from
+// and reach back into earlier ones.
+class InputPieces : public InputBase {
+ public:
+  InputPieces() : InputBase(true) {}
+  ~InputPieces() override = default;
+
+  // Hands out the lines of `lines` next, it has to stay valid while they are read.
+  void Feed(std::string_view lines) { rest_ = lines; }
+  std::optional<std::string_view> GetLine() override;
+ private:
+  std::string_view rest_;
+};
+
+// Splits `content` into consecutive pieces of roughly `chunk_size` bytes. Every
+// piece except possibly the last ends right after a newline.
+std::vector<std::string_view> SplitIntoChunks(std::string_view content, size_t chunk_size);
+
 } // namespace gai
 
 #endif // GAI_INPUT_H_
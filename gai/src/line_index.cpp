@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sys/stat.h>
+
+#include "disk_entry.h"
+#include "line_index.h"
+#include "simd.h"
+
+namespace gai {
+
+namespace fs = std::filesystem;
+
+// Bumped whenever the entry layout changes.
+constexpr std::string_view kMagic = "GAILIX01";
+
+// Bytes at the start and at the end of the indexed part that have to be
+// unchanged for an index to be extended rather than rebuilt.
+constexpr size_t kFingerprintSize = 4 << 10;
+
+// Directory of the index, empty while disabled.
+static std::string index_directory;
+
+static uint64_t Fingerprint(std::string_view content, size_t size) {
+  const std::string_view indexed = content.substr(0, size);
+  const size_t n = std::min(kFingerprintSize, indexed.size());
+  return Fnv1a(indexed.substr(indexed.size() - n), Fnv1a(indexed.substr(0, n)));
+}
+
+// What a file has to agree on for its index to be used as is.
+struct FileKey {
+  uint64_t device{0};
+  uint64_t inode{0};
+  int64_t mtime_ns{0};
+};
+
+static FileKey KeyOf(const struct stat& st) {
+  return {static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino),
+          static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec};
+}
+
+// Named after the hash of the absolute path of the file. The path is stored
+// in the entry and compared on load, so collisions only cost a rebuild.
+static fs::path EntryPath(std::string_view path) {
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.lidx", static_cast<unsigned long long>(Fnv1a(path)));
+  return fs::path{index_directory} / name;
+}
+
+struct Entry {
+  FileKey key;
+  uint64_t fingerprint{0};
+  LineIndex index;
+};
+
+static std::optional<Entry> LoadEntry(const fs::path& entry_path, std::string_view path) {
+  std::ifstream file{entry_path, std::ios::binary};
+  if (!file) return std::nullopt;
+  const std::string data{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+  std::string_view in{data};
+  if (!in.starts_with(kMagic)) return std::nullopt;
+  in.remove_prefix(kMagic.size());
+
+  Entry entry;
+  uint64_t path_size{0};
+  if (!ReadValue(in, path_size) || (in.size() < path_size) || (in.substr(0, path_size) != path)) return std::nullopt;
+  in.remove_prefix(path_size);
+  uint64_t lines_per_entry{0};
+  uint64_t count{0};
+  if (!ReadValue(in, entry.key.device) || !ReadValue(in, entry.key.inode) || !ReadValue(in, entry.key.mtime_ns) ||
+      !ReadValue(in, entry.index.indexed_size) || !ReadValue(in, entry.fingerprint) ||
+      !ReadValue(in, lines_per_entry) || !ReadValue(in, count)) {
+    return std::nullopt;
+  }
+  if ((lines_per_entry == 0) || (count == 0) || (in.size() != (count + 1) * sizeof(uint64_t))) return std::nullopt;
+  const std::string_view table = in.substr(0, count * sizeof(uint64_t));
+  in.remove_prefix(table.size());
+  uint64_t checksum{0};
+  if (!ReadValue(in, checksum) || (checksum != Fnv1a(table))) return std::nullopt;
+
+  entry.index.lines_per_entry = lines_per_entry;
+  entry.index.offsets.resize(count);
+  std::memcpy(entry.index.offsets.data(), table.data(), table.size());
+  // a damaged table must not send a seek past the file
+  const std::vector<uint64_t>& offsets = entry.index.offsets;
+  if ((offsets.front() != 0) || !std::is_sorted(offsets.begin(), offsets.end()) ||
+      (offsets.back() > entry.index.indexed_size)) {
+    return std::nullopt;
+  }
+  return entry;
+}
+
+static void StoreEntry(const fs::path& entry_path, std::string_view path, const Entry& entry) {
+  std::string data{kMagic};
+  AppendValue(data, static_cast<uint64_t>(path.size()));
+  data.append(path);
+  AppendValue(data, entry.key.device);
+  AppendValue(data, entry.key.inode);
+  AppendValue(data, entry.key.mtime_ns);
+  AppendValue(data, entry.index.indexed_size);
+  AppendValue(data, entry.fingerprint);
+  AppendValue(data, static_cast<uint64_t>(entry.index.lines_per_entry));
+  AppendValue(data, static_cast<uint64_t>(entry.index.offsets.size()));
+  const std::string_view table{reinterpret_cast<const char*>(entry.index.offsets.data()),
+                               entry.index.offsets.size() * sizeof(uint64_t)};
+  data.append(table);
+  AppendValue(data, Fnv1a(table));
+  WriteFileAtomically(entry_path, data);
+}
+
+void LineIndex::Extend(std::string_view content) {
+  // lines after the last entry were not recorded, counting resumes there
+  size_t at = offsets.back();
+  while (true) {
+    const size_t skip = gai::SkipLines(content.substr(at), lines_per_entry);
+    if (skip == std::string_view::npos) break;
+    at += skip;
+    offsets.push_back(at);
+  }
+  indexed_size = content.size();
+}
+
+size_t LineIndex::SkipLines(std::string_view content, size_t lines) const {
+  const size_t k = std::min(lines / lines_per_entry, offsets.size() - 1);
+  const size_t from = offsets[k];
+  if (from > content.size()) return gai::SkipLines(content, lines);
+  const size_t skip = gai::SkipLines(content.substr(from), lines - k * lines_per_entry);
+  return (skip == std::string_view::npos) ? skip : from + skip;
+}
+
+void LineIndex::Split(std::string_view content, std::string_view slice, size_t linenum, size_t chunk_size,
+                      std::vector<std::string_view>& chunks, std::vector<size_t>& first_linenum) const {
+  chunks.clear();
+  first_linenum.clear();
+  const size_t begin = static_cast<size_t>(slice.data() - content.data());
+  const size_t end = begin + slice.size();
+  size_t chunk_begin = begin;
+  size_t chunk_linenum = linenum;
+  // entries are in offset order, the first one past the slice ends the search
+  for (size_t k = 0; (k < offsets.size()) && (offsets[k] < end); ++k) {
+    if (offsets[k] < chunk_begin + std::max<size_t>(chunk_size, 1)) continue;
+    chunks.push_back(content.substr(chunk_begin, offsets[k] - chunk_begin));
+    first_linenum.push_back(chunk_linenum);
+    chunk_begin = offsets[k];
+    chunk_linenum = k * lines_per_entry;
+  }
+  if ((chunk_begin < end) || chunks.empty()) {
+    chunks.push_back(content.substr(chunk_begin, end - chunk_begin));
+    first_linenum.push_back(chunk_linenum);
+  }
+}
+
+void EnableLineIndex(std::string_view directory) {
+  index_directory = directory;
+  std::error_code ec;
+  if (!index_directory.empty()) fs::create_directories(index_directory, ec);
+}
+
+std::optional<LineIndex> GetLineIndex(const std::string& path, std::string_view content) {
+  if (index_directory.empty() || (content.size() < kMinIndexedSize)) return std::nullopt;
+  struct stat st{};
+  if (::stat(path.c_str(), &st) != 0) return std::nullopt;
+  std::error_code ec;
+  const std::string absolute = fs::absolute(path, ec).lexically_normal().string();
+  if (ec) return std::nullopt;
+
+  const FileKey key = KeyOf(st);
+  const fs::path entry_path = EntryPath(absolute);
+  std::optional<Entry> entry = LoadEntry(entry_path, absolute);
+  const bool same_file = entry && (entry->key.device == key.device) && (entry->key.inode == key.inode) &&
+                         (entry->index.indexed_size <= content.size()) &&
+                         (entry->fingerprint == Fingerprint(content, entry->index.indexed_size));
+  if (same_file && (entry->index.indexed_size == content.size()) && (entry->key.mtime_ns == key.mtime_ns)) {
+    return std::move(entry->index);
+  }
+  // rewritten in place, replaced or truncated files are indexed again, files
+  // that only grew are indexed from their last entry on
+  if (!same_file || (entry->index.indexed_size == content.size())) entry = Entry{};
+  entry->key = key;
+  entry->index.Extend(content);
+  entry->fingerprint = Fingerprint(content, entry->index.indexed_size);
+  StoreEntry(entry_path, absolute, *entry);
+  return std::move(entry->index);
+}
+
+} // namespace gai
@@ -0,0 +1,63 @@
+#ifndef GAI_LINE_INDEX_H_
+#define GAI_LINE_INDEX_H_
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace gai {
+
+// Opt-in on-disk index of where the lines of large plain files start, so a
+// line number can be found without counting every newline in front of it.
+// An index records the offset just past every `lines_per_entry`-th newline;
+// reaching line N costs a table lookup and a count of fewer than
+// `lines_per_entry` lines from the closest entry.
+//
+// Entries are kept in a directory, one per file, and are keyed by the file's
+// device, inode, size and modification time. A file that only grew since it
+// was indexed (same inode, same bytes at the end of the indexed part) has its
+// index extended from the last entry instead of rebuilt; anything else is
+// indexed again. Like the pattern cache the index is best effort: I/O errors
+// leave the file unindexed and it is scanned as without an index.
+struct LineIndex {
+  static constexpr size_t kLinesPerEntry = 1 << 16;
+
+  size_t lines_per_entry{kLinesPerEntry};
+  // offsets[k] is the offset just past the (k * lines_per_entry)-th newline,
+  // offsets[0] is 0
+  std::vector<uint64_t> offsets{0};
+  // bytes of the file the entries were made from
+  uint64_t indexed_size{0};
+
+  // Adds the entries of the bytes of `content` past `indexed_size`. `content`
+  // has to start with the bytes that were indexed so far.
+  void Extend(std::string_view content);
+
+  // Same as SkipLines(content, lines), starting from the closest entry.
+  size_t SkipLines(std::string_view content, size_t lines) const;
+
+  // Splits `slice`, a part of `content` that follows line `linenum`, into
+  // chunks of at least `chunk_size` bytes that start at entries, so every
+  // chunk is line aligned and its first line number is known without
+  // counting.
+  void Split(std::string_view content, std::string_view slice, size_t linenum, size_t chunk_size,
+             std::vector<std::string_view>& chunks, std::vector<size_t>& first_linenum) const;
+};
+
+// Files smaller than this are not indexed, counting their lines is cheap.
+constexpr size_t kMinIndexedSize = 16 << 20;
+
+// Enables the index in `directory`, which is created when missing; an empty
+// directory disables it.
+void EnableLineIndex(std::string_view directory);
+
+// Returns the index of `content`, the contents of the plain file `path`:
+// loaded, extended after the file grew, or built, and stored back when it
+// changed. Empty while disabled and for files below kMinIndexedSize.
+std::optional<LineIndex> GetLineIndex(const std::string& path, std::string_view content);
+
+} // namespace gai
+
+#endif // GAI_LINE_INDEX_H_
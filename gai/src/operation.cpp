@@ -49,7 +49,7 @@ bool Range::IsStartReached(std::string_view content, size_t linenum) {
     is_start_reached_ = std::visit(Overloaded{
                                    [](const std::monostate&) { return true; },
                                    [&linenum](size_t start_line) { return linenum == start_line; },
-                                   [&content](const Pcre2Regex& regex) { return Find(regex, content); }
+                                   [&content](const SharedRegex& regex) { return Find(*regex, content); }
                                   }, start);
     if (is_start_reached_) {
      // do not reset 'end' if end represents line-numbers
@@ -66,11 +66,11 @@ bool Range::IsEndReached(std::string_view content, size_t linenum) {
     is_end_reached_ = std::visit(Overloaded{
                                    [](const std::monostate&) { return false; },
                                    [&linenum](size_t end_line) { return linenum == end_line; },
-                                   [&content](const Pcre2Regex& regex) { return Find(regex, content); }
+                                   [&content](const SharedRegex& regex) { return Find(*regex, content); }
                                   }, end);
     if (is_end_reached_) {
       // only reset if we are in regex mode for 'start'
-      if (std::holds_alternative<Pcre2Regex>(start)) {
+      if (std::holds_alternative<SharedRegex>(start)) {
         is_start_reached_ = false;
       }
     }
@@ -83,11 +83,45 @@ void Range::Reset() {
   is_end_reached_ = false;
 }
 
-std::optional<Pcre2Substitution> ParseSub(std::string_view expr, bool jit, bool utf) {
+bool Range::IsLineBased() const {
+  return !std::holds_alternative<SharedRegex>(start) && !std::holds_alternative<SharedRegex>(end);
+}
+
+void Range::Seek(size_t linenum) {
+  // an open start behaves like a start at line 1, a start at line 0 is never reached
+  const size_t first = std::holds_alternative<size_t>(start) ? std::get<size_t>(start) : 1;
+  is_start_reached_ = (first > 0) && (first <= linenum);
+  if (std::holds_alternative<std::monostate>(start)) is_start_reached_ = true;
+
+  is_end_reached_ = false;
+  if (is_start_reached_ && std::holds_alternative<size_t>(end)) {
+    const size_t last = std::get<size_t>(end);
+    is_end_reached_ = (first <= last) && (last <= linenum);
+  }
+}
+
+size_t Range::PendingStart() const {
+  return (!is_start_reached_ && std::holds_alternative<size_t>(start)) ? std::get<size_t>(start) : 0;
+}
+
+size_t Range::EndLine() const {
+  if (!IsLineBased() || !std::holds_alternative<size_t>(end)) return 0;
+  // an end in front of the start is never seen once the range is open
+  const size_t first = std::holds_alternative<size_t>(start) ? std::get<size_t>(start) : 1;
+  const size_t last = std::get<size_t>(end);
+  return ((first > 0) && (first <= last)) ? last : 0;
+}
+
+bool Range::IsFinished() const {
+  return is_end_reached_ && std::holds_alternative<size_t>(end);
+}
+
+std::optional<Pcre2Substitution> ParseSub(std::string_view expr, bool jit, bool utf,
+                                          std::optional<InvalidUtf8> invalid_utf8) {
   std::vector<std::string_view> parts = Split(expr);
   std::optional<Pcre2Substitution> out;
   if (parts.size() == 2) {
-    out.emplace(Compile(parts[0], jit, utf), parts[1]);
+    out.emplace(Compile(parts[0], jit, utf, invalid_utf8), parts[1]);
   } else {
     std::string_view error_msg = common::FormatIntoStringView<"Invalid substitute expression passed.\nExpression: %s\n">(expr);
     throw std::runtime_error(std::string(error_msg));
@@ -95,18 +129,16 @@ std::optional<Pcre2Substitution> ParseSub(std::string_view expr, bool jit, bool
   return out;
 }
 
-std::vector<Pcre2Regex> ParseFilters(const std::vector<std::string_view>& filters, bool jit, bool utf) {
-  std::vector<Pcre2Regex> out{};
-  for (const std::string_view& f : filters) {
-    out.emplace_back(Regex(Compile(f, jit, utf)));
-  }
-  return out;
+Pcre2PatternSet ParseFilters(const std::vector<std::string_view>& filters, bool jit, bool utf,
+                             std::optional<InvalidUtf8> invalid_utf8) {
+  return CompileSet(filters, jit, utf, invalid_utf8);
 }
 
-std::vector<Pcre2Substitution> ParseSubstitutions(const std::vector<std::string_view>& substitutions, bool jit, bool utf) {
+std::vector<Pcre2Substitution> ParseSubstitutions(const std::vector<std::string_view>& substitutions, bool jit, bool utf,
+                                                  std::optional<InvalidUtf8> invalid_utf8) {
   std::vector<Pcre2Substitution> out{};
   for (const std::string_view& sub : substitutions) {
-    auto p = ParseSub(sub, jit, utf);
+    auto p = ParseSub(sub, jit, utf, invalid_utf8);
     if (p) {
       out.emplace_back(std::move(*p));
     }
@@ -114,17 +146,18 @@ std::vector<Pcre2Substitution> ParseSubstitutions(const std::vector<std::string_
   return out;
 }
 
-std::optional<Range> ParseRange(std::string_view expr, bool jit, bool utf) {
+std::optional<Range> ParseRange(std::string_view expr, bool jit, bool utf,
+                                std::optional<InvalidUtf8> invalid_utf8) {
   std::optional<Range> out{std::nullopt};
   std::vector<std::string_view> parts = Split(expr);
   if (parts.empty()) return out;
 
-  auto parse_value = [jit, utf](const std::string_view s) -> RangeValue {
+  auto parse_value = [jit, utf, invalid_utf8](const std::string_view s) -> RangeValue {
     if (s.empty()) return std::monostate{};
     if (std::all_of(s.begin(), s.end(), ::isdigit)) {
       return static_cast<size_t>(std::stoul(std::string{s}));
     }
-    return Regex(Compile(s, jit, utf));
+    return std::make_shared<const Pcre2Regex>(Compile(s, jit, utf, invalid_utf8));
   };
 
   if (parts.size() == 2) {
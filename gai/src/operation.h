@@ -8,7 +8,8 @@
 
 namespace gai {
 
-using RangeValue = std::variant<std::monostate, size_t, Pcre2Regex>;
+// Regex bounds are shared, copies of a range only duplicate its state.
+using RangeValue = std::variant<std::monostate, size_t, SharedRegex>;
 struct Range {
   RangeValue start;
   RangeValue end;
@@ -17,18 +18,40 @@ struct Range {
   bool IsEndReached(std::string_view content, size_t linenum);
   void Reset();
 
+  // True when neither bound is a regex, so whether a line is inside the range
+  // depends on its line number alone.
+  bool IsLineBased() const;
+  // Puts a line based range into the state it would be in after lines
+  // 1..linenum went through IsStartReached/IsEndReached.
+  void Seek(size_t linenum);
+
+  // Line number start that has not been reached yet, 0 if there is none.
+  // Nothing changes before it, so the lines in front can be skipped unseen.
+  size_t PendingStart() const;
+  // Line from which on no line of a line based range is inside it, 0 if the
+  // range runs to the end of the input.
+  size_t EndLine() const;
+  // True once no later line can be inside the range: its end is a line
+  // number that was passed, and nothing reopens such a range.
+  bool IsFinished() const;
+
  private:
   bool is_start_reached_{false};
   bool is_end_reached_{false};
 };
 
-std::vector<Pcre2Regex> ParseFilters(const std::vector<std::string_view>& filters, bool jit, bool utf);
-std::vector<Pcre2Substitution> ParseSubstitutions(const std::vector<std::string_view>& substitutions, bool jit, bool utf);
-std::optional<Range> ParseRange(std::string_view expr, bool jit, bool utf);
+// `invalid_utf8` is the policy of UTF patterns, see InvalidUtf8.
+Pcre2PatternSet ParseFilters(const std::vector<std::string_view>& filters, bool jit, bool utf,
+                             std::optional<InvalidUtf8> invalid_utf8 = std::nullopt);
+std::vector<Pcre2Substitution> ParseSubstitutions(const std::vector<std::string_view>& substitutions, bool jit, bool utf,
+                                                  std::optional<InvalidUtf8> invalid_utf8 = std::nullopt);
+std::optional<Range> ParseRange(std::string_view expr, bool jit, bool utf,
+                                std::optional<InvalidUtf8> invalid_utf8 = std::nullopt);
 
 std::string_view Trim(std::string_view v);
 std::vector<std::string_view> Split(std::string_view expr);
-std::optional<Pcre2Substitution> ParseSub(std::string_view expr, bool jit, bool utf);
+std::optional<Pcre2Substitution> ParseSub(std::string_view expr, bool jit, bool utf,
+                                          std::optional<InvalidUtf8> invalid_utf8 = std::nullopt);
 
 } // namespace gai
 
@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+#include <utility>
+
+#include "output.h"
+#include "stats.h"
+
+namespace gai {
+
+// Prefixes and copied lines are collected here until the next flush.
+constexpr size_t kArenaSize = 64 << 10;
+// Entries per writev call.
+constexpr size_t kMaxIov = IOV_MAX;
+
+static const char kNewline = '\n';
+
+OutputSink::OutputSink(int fd, bool verbose, std::string_view delimiter)
+  : fd_{fd}, verbose_{verbose}, delimiter_{delimiter}, arena_{std::make_unique<char[]>(kArenaSize)} {
+  iov_.reserve(kMaxIov);
+}
+
+OutputSink::OutputSink(std::string& buffer, bool verbose, std::string_view delimiter)
+  : buffer_{&buffer}, verbose_{verbose}, delimiter_{delimiter} {}
+
+OutputSink::~OutputSink() {
+  try {
+    Flush();
+  } catch (...) {
+  }
+}
+
+size_t OutputSink::MaxPrefixSize() const {
+  return verbose_ ? (filename_.size() + 2 * std::max<size_t>(delimiter_.size(), 1) + 20) : 0;
+}
+
+size_t OutputSink::FormatPrefix(char* out, size_t linenum, bool context) const {
+  const std::string_view delimiter = context ? std::string_view{"-"} : delimiter_;
+  char* ptr = out;
+  if (!filename_.empty()) {
+    ptr = std::copy(filename_.begin(), filename_.end(), ptr);
+    ptr = std::copy(delimiter.begin(), delimiter.end(), ptr);
+  }
+  ptr = std::to_chars(ptr, ptr + 20, linenum).ptr;
+  ptr = std::copy(delimiter.begin(), delimiter.end(), ptr);
+  return static_cast<size_t>(ptr - out);
+}
+
+void OutputSink::Write(std::string_view text) {
+  if (buffer_) {
+    buffer_->append(text);
+    return;
+  }
+  if ((iov_.size() + 1 > kMaxIov) || (arena_used_ + text.size() > kArenaSize)) Flush();
+  if (text.size() > kArenaSize) {
+    Push(text.data(), text.size());
+    Flush();
+    return;
+  }
+  char* out = Allocate(text.size());
+  std::memcpy(out, text.data(), text.size());
+  Push(out, text.size());
+}
+
+void OutputSink::WriteView(std::string_view text) {
+  const bool stable = (text.data() >= source_.data()) && (text.data() + text.size() <= source_.data() + source_.size());
+  if (buffer_ || !stable) {
+    Write(text);
+    return;
+  }
+  if (iov_.size() + 1 > kMaxIov) Flush();
+  Push(text.data(), text.size());
+}
+
+void OutputSink::EmitSeparator() {
+  if (PrintsLines()) Write("--\n");
+}
+
+void OutputSink::EndFile() {
+  const size_t matches = std::exchange(matches_, 0);
+  matched_linenum_ = 0;
+  if (mode_ == Mode::kCount) {
+    char count[24];
+    const char* end = std::to_chars(count, count + sizeof(count), matches).ptr;
+    if (!filename_.empty()) {
+      Write(filename_);
+      Write(delimiter_);
+    }
+    Write({count, static_cast<size_t>(end - count)});
+    Write("\n");
+  } else if ((mode_ == Mode::kFilesWithMatches) && (matches > 0)) {
+    Write(filename_.empty() ? std::string_view{"(standard input)"} : filename_);
+    Write("\n");
+  }
+}
+
+void OutputSink::Emit(std::string_view line, size_t linenum, bool context) {
+  if (!context) ++matches_;
+  if (!PrintsLines()) return;
+  if (buffer_) {
+    if (verbose_) {
+      const size_t at = buffer_->size();
+      buffer_->resize(at + MaxPrefixSize());
+      buffer_->resize(at + FormatPrefix(buffer_->data() + at, linenum, context));
+    }
+    buffer_->append(line).push_back('\n');
+    return;
+  }
+
+  const char* source_end = source_.data() + source_.size();
+  const bool stable = (line.data() >= source_.data()) && (line.data() + line.size() <= source_end);
+  const bool has_newline = stable && (line.data() + line.size() < source_end) && (line.data()[line.size()] == '\n');
+  const size_t copied = stable ? (has_newline ? 0 : 1) : (line.size() + 1);
+  const size_t prefix = MaxPrefixSize();
+  if ((iov_.size() + 3 > kMaxIov) || (arena_used_ + prefix + copied > kArenaSize)) Flush();
+
+  if (verbose_) {
+    char* out = Allocate(prefix);
+    const size_t n = FormatPrefix(out, linenum, context);
+    arena_used_ -= prefix - n;
+    Push(out, n);
+  }
+
+  if (stable) {
+    Push(line.data(), line.size() + (has_newline ? 1 : 0));
+    if (!has_newline) Push(&kNewline, 1);
+  } else if (arena_used_ + copied <= kArenaSize) {
+    char* out = Allocate(copied);
+    std::memcpy(out, line.data(), line.size());
+    out[line.size()] = '\n';
+    Push(out, copied);
+  } else {
+    // too large for the arena, the line is only valid until we return
+    Push(line.data(), line.size());
+    Push(&kNewline, 1);
+    Flush();
+  }
+}
+
+void OutputSink::EmitMatch(const std::vector<std::string_view>& groups, size_t linenum) {
+  if (std::exchange(matched_linenum_, linenum) != linenum) ++matches_;
+  if (!PrintsLines()) return;
+  if (buffer_) {
+    if (verbose_) {
+      const size_t at = buffer_->size();
+      buffer_->resize(at + MaxPrefixSize());
+      buffer_->resize(at + FormatPrefix(buffer_->data() + at, linenum, false));
+    }
+    for (size_t k = 0; k < groups.size(); ++k) {
+      if (k > 0) buffer_->append(delimiter_);
+      buffer_->append(groups[k]);
+    }
+    buffer_->push_back('\n');
+    return;
+  }
+
+  const size_t prefix = MaxPrefixSize();
+  if ((iov_.size() + 2 * groups.size() + 1 > kMaxIov) || (arena_used_ + prefix > kArenaSize)) Flush();
+  if (verbose_) {
+    char* out = Allocate(prefix);
+    const size_t n = FormatPrefix(out, linenum, false);
+    arena_used_ -= prefix - n;
+    Push(out, n);
+  }
+  for (size_t k = 0; k < groups.size(); ++k) {
+    // the delimiter outlives the sink and is referenced, not copied
+    if (k > 0) Push(delimiter_.data(), delimiter_.size());
+    WriteView(groups[k]);
+  }
+  if (iov_.size() + 1 > kMaxIov) Flush();
+  Push(&kNewline, 1);
+}
+
+void OutputSink::Push(const char* data, size_t size) {
+  if (size == 0) return;
+  if (!iov_.empty()) {
+    iovec& last = iov_.back();
+    if (static_cast<const char*>(last.iov_base) + last.iov_len == data) {
+      last.iov_len += size;
+      return;
+    }
+  }
+  iov_.push_back(iovec{const_cast<char*>(data), size});
+}
+
+char* OutputSink::Allocate(size_t size) {
+  char* out = arena_.get() + arena_used_;
+  arena_used_ += size;
+  return out;
+}
+
+void OutputSink::Flush() {
+  StageTimer timer(Stage::kOutput);
+  size_t first = 0;
+  while (first < iov_.size()) {
+    const int count = static_cast<int>(std::min(iov_.size() - first, kMaxIov));
+    const ssize_t n = ::writev(fd_, iov_.data() + first, count);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      iov_.clear();
+      arena_used_ = 0;
+      throw std::runtime_error(std::string("Unable to write output: ") + std::strerror(errno));
+    }
+
+    // skip what was written, a short write leaves a partial entry behind
+    size_t written = static_cast<size_t>(n);
+    while ((first < iov_.size()) && (written >= iov_[first].iov_len)) {
+      written -= iov_[first].iov_len;
+      ++first;
+    }
+    if (written > 0) {
+      iov_[first].iov_base = static_cast<char*>(iov_[first].iov_base) + written;
+      iov_[first].iov_len -= written;
+    }
+  }
+  iov_.clear();
+  arena_used_ = 0;
+}
+
+} // namespace gai
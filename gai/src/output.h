@@ -0,0 +1,118 @@
+#ifndef GAI_OUTPUT_H_
+#define GAI_OUTPUT_H_
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/uio.h>
+
+namespace gai {
+
+// Destination of emitted lines. Either batches iovecs for writev(2) on a file
+// descriptor or appends to a caller owned string (used by workers whose output
+// is ordered afterwards).
+//
+// In descriptor mode, lines lying inside the source buffer (see SetSource) are
+// not copied: their iovec points straight into it and takes the newline that
+// follows them along, and iovecs that continue each other are merged, so a run
+// of matching lines becomes a single entry. Prefixes and lines from anywhere
+// else (replacements, stdin blocks) are copied into a small arena. Pending
+// output refers to the source, so Flush() has to run before it goes away.
+class OutputSink {
+ public:
+  // What is printed: the lines, their number per file (-c) or the names of
+  // the files with a match (-l). Counts and names are printed by EndFile().
+  enum class Mode { kLines, kCount, kFilesWithMatches };
+
+  OutputSink(int fd, bool verbose, std::string_view delimiter);
+  OutputSink(std::string& buffer, bool verbose, std::string_view delimiter);
+  ~OutputSink();
+  OutputSink(const OutputSink&) = delete;
+  OutputSink& operator=(const OutputSink&) = delete;
+
+  // Buffer whose lines may be referenced until the next Flush().
+  void SetSource(std::string_view source) { source_ = source; }
+  // Printed in front of line numbers in verbose mode, must outlive the output.
+  void SetFilename(std::string_view filename) { filename_ = filename; }
+
+  // Lines printed around every match (-A/-B/-C), carried out by Process()
+  // and ProcessBuffer().
+  void SetContext(size_t before, size_t after) {
+    before_ = before;
+    after_ = after;
+  }
+  size_t Before() const { return before_; }
+  size_t After() const { return after_; }
+  bool HasContext() const { return (before_ > 0) || (after_ > 0); }
+
+  void SetMode(Mode mode) { mode_ = mode; }
+  // Stops a file after `count` matching lines (-m), 0 for no limit.
+  void SetMaxCount(size_t count) { max_count_ = count; }
+  // Prints the given capture groups of every match instead of whole lines
+  // (-o), group 0 being the whole match; no groups print lines.
+  void SetGroups(std::vector<size_t> groups) { groups_ = std::move(groups); }
+  const std::vector<size_t>& Groups() const { return groups_; }
+  // False when lines are only counted, so callers can skip preparing them.
+  bool PrintsLines() const { return mode_ == Mode::kLines; }
+  // True when lines are printed as their matches, see EmitMatch().
+  bool PrintsMatches() const { return PrintsLines() && !groups_.empty(); }
+  // True once no later line of the current file can change the output,
+  // Process() and ProcessBuffer() stop reading then.
+  bool Done() const {
+    const size_t limit = (mode_ == Mode::kFilesWithMatches) ? 1 : max_count_;
+    return (limit > 0) && (matches_ >= limit);
+  }
+  // True when Done() can become true before the end of a file.
+  bool StopsEarly() const { return (mode_ == Mode::kFilesWithMatches) || (max_count_ > 0); }
+  // Prints the count or name of the current file and starts the next one.
+  // Files are named by SetFilename(), stdin has none.
+  void EndFile();
+
+  // Context lines are prefixed with '-' instead of the delimiter in verbose
+  // mode, like grep does.
+  void Emit(std::string_view line, size_t linenum, bool context = false);
+  // Prints the groups of one match on line `linenum` joined by the delimiter,
+  // after the verbose prefix. A line with several matches is counted once.
+  // Groups inside the source are referenced like lines are, nothing is
+  // copied for them.
+  void EmitMatch(const std::vector<std::string_view>& groups, size_t linenum);
+  // "--" between groups of context that do not touch.
+  void EmitSeparator();
+
+  // Writes everything pending. No-op in string mode.
+  void Flush();
+
+ private:
+  // Formats the verbose prefix of `linenum` into `out`, returns its length.
+  size_t FormatPrefix(char* out, size_t linenum, bool context) const;
+  size_t MaxPrefixSize() const;
+  // Copies `text` into the output.
+  void Write(std::string_view text);
+  // References `text` when it lies inside the source, copies it otherwise.
+  void WriteView(std::string_view text);
+  void Push(const char* data, size_t size);
+  char* Allocate(size_t size);
+
+  int fd_{-1};
+  std::string* buffer_{nullptr};
+  bool verbose_{false};
+  std::string_view delimiter_;
+  std::string_view filename_;
+  std::string_view source_;
+  size_t before_{0};
+  size_t after_{0};
+  Mode mode_{Mode::kLines};
+  size_t max_count_{0};
+  size_t matches_{0};  // in the current file
+  std::vector<size_t> groups_;
+  size_t matched_linenum_{0};  // line of the last EmitMatch() in the current file
+
+  std::vector<iovec> iov_;
+  std::unique_ptr<char[]> arena_;
+  size_t arena_used_{0};
+};
+
+} // namespace gai
+
+#endif // GAI_OUTPUT_H_
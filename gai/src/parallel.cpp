@@ -0,0 +1,168 @@
+#include "parallel.h"
+#include "stats.h"
+
+namespace gai {
+
+// Identifies the pool (and the slot within it) that the current thread works for.
+thread_local const WorkStealingPool* tls_pool{nullptr};
+thread_local size_t tls_worker{0};
+
+WorkStealingPool::WorkStealingPool(size_t num_threads) {
+  if (num_threads == 0) num_threads = 1;
+  queues_.reserve(num_threads);
+  for (size_t i = 0; i < num_threads; ++i) {
+    queues_.emplace_back(std::make_unique<Queue>());
+  }
+  workers_.reserve(num_threads);
+  for (size_t i = 0; i < num_threads; ++i) {
+    workers_.emplace_back(&WorkStealingPool::WorkerLoop, this, i);
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  for (std::thread& t : workers_) {
+    if (t.joinable()) t.join();
+  }
+}
+
+void WorkStealingPool::Submit(Task task) {
+  // pending before it is queued, so Wait() cannot miss a task on its way
+  ++pending_;
+  const size_t target = (tls_pool == this) ? tls_worker : (next_queue_++ % queues_.size());
+  {
+    std::lock_guard<std::mutex> lock(queues_[target]->mutex);
+    queues_[target]->tasks.push_back(std::move(task));
+  }
+  ++queued_;
+  // A worker about to sleep counts itself before it checks queued_, and this
+  // checks sleepers_ after counting the task, so one side always sees the
+  // other. The lock is only free once that worker is waiting.
+  if (sleepers_ > 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    work_cv_.notify_one();
+  }
+}
+
+void WorkStealingPool::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [this] { return pending_ == 0; });
+  if (error_) {
+    std::exception_ptr error = std::exchange(error_, nullptr);
+    std::rethrow_exception(error);
+  }
+}
+
+bool WorkStealingPool::TryPop(size_t index, Task& task) {
+  {  // own queue: oldest first, keeps the submission order mostly intact
+    Queue& own = *queues_[index];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.front());
+      own.tasks.pop_front();
+    }
+  }
+  // steal the newest task of a victim, the victim keeps working on its oldest ones
+  for (size_t k = 1; !task && k < queues_.size(); ++k) {
+    Queue& victim = *queues_[(index + k) % queues_.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.back());
+      victim.tasks.pop_back();
+    }
+  }
+  if (!task) return false;
+  --queued_;
+  return true;
+}
+
+void WorkStealingPool::WorkerLoop(size_t index) {
+  tls_pool = this;
+  tls_worker = index;
+
+  Task task;
+  while (true) {
+    if (!TryPop(index, task)) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      ++sleepers_;
+      work_cv_.wait(lock, [this] { return stop_ || (queued_ > 0); });
+      --sleepers_;
+      if (stop_ && (queued_ == 0)) break;
+      continue;
+    }
+
+    try {
+      task(index);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!error_) error_ = std::current_exception();
+    }
+    task = nullptr;
+
+    if (--pending_ == 0) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      done_cv_.notify_all();
+    }
+  }
+  tls_pool = nullptr;
+}
+
+OrderedWriter::OrderedWriter(FILE* stream, size_t first_sequence) : stream_{stream}, next_{first_sequence} {}
+
+void OrderedWriter::Complete(const Slot& slot, std::string& output) {
+  StageTimer timer(Stage::kOutput);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (slot != next_) {
+    parked_.emplace(slot, std::move(output));
+    output.clear();
+    return;
+  }
+
+  if (!output.empty()) std::fwrite(output.data(), 1, output.size(), stream_);
+  output.clear();
+  Next();
+  Advance();
+}
+
+void OrderedWriter::Split(const Slot& slot, size_t count) {
+  StageTimer timer(Stage::kOutput);
+  std::lock_guard<std::mutex> lock(mutex_);
+  splits_.emplace(slot, count);
+  Advance();
+}
+
+void OrderedWriter::Advance() {
+  while (true) {
+    if (auto it = parked_.find(next_); it != parked_.end()) {
+      if (!it->second.empty()) std::fwrite(it->second.data(), 1, it->second.size(), stream_);
+      parked_.erase(it);
+      Next();
+    } else if (auto split = splits_.find(next_); split != splits_.end()) {
+      const size_t count = split->second;
+      splits_.erase(split);
+      if (count == 0) {
+        Next();
+      } else {
+        counts_.push_back(count);
+        next_.push_back(0);
+      }
+    } else {
+      return;
+    }
+  }
+}
+
+void OrderedWriter::Next() {
+  ++next_.back();
+  while (!counts_.empty() && (next_.back() == counts_.back())) {
+    counts_.pop_back();
+    next_.pop_back();
+    ++next_.back();
+  }
+}
+
+} // namespace gai
@@ -0,0 +1,112 @@
+#ifndef GAI_PARALLEL_H_
+#define GAI_PARALLEL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace gai {
+
+// Fixed-size pool where every worker owns a task deque. A worker pops from the
+// front of its own deque and, once that is empty, steals from the back of the
+// others. Tasks receive the index of the worker running them so callers can
+// keep per-worker state without locking. Pushing, popping and stealing only
+// lock the deque involved, the counters are atomic; the pool's own mutex is
+// taken to sleep and wake only.
+class WorkStealingPool {
+ public:
+  using Task = std::function<void(size_t worker)>;
+
+  explicit WorkStealingPool(size_t num_threads);
+  ~WorkStealingPool();
+  WorkStealingPool(const WorkStealingPool&) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+  // Tasks submitted from a worker go to that worker's own deque, everything
+  // else is spread round-robin.
+  void Submit(Task task);
+
+  // Blocks until every submitted task has finished. Rethrows the first
+  // exception raised by a task.
+  void Wait();
+
+  size_t Size() const { return workers_.size(); }
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void WorkerLoop(size_t index);
+  bool TryPop(size_t index, Task& task);
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> workers_;
+
+  // queued: in a deque, pending: submitted and not finished
+  std::atomic<size_t> queued_{0};
+  std::atomic<size_t> pending_{0};
+  std::atomic<size_t> next_queue_{0};
+  // workers waiting on work_cv_, a Submit() that sees none needs no lock
+  std::atomic<size_t> sleepers_{0};
+
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  bool stop_{false};
+  std::exception_ptr error_{nullptr};
+};
+
+// Writes per-task output to a stream strictly in slot order, regardless of
+// the order in which tasks complete. A slot is a path: the top-level sequence
+// number followed by one index for every level the output was split into, so
+// a task that finds out late how its output breaks up (a directory listing,
+// a file cut into chunks) splits its own slot and the pieces are written in
+// its place.
+class OrderedWriter {
+ public:
+  using Slot = std::vector<size_t>;
+
+  explicit OrderedWriter(FILE* stream, size_t first_sequence = 0);
+
+  // Hands over the output of slot `slot`. If it is next in line it is written
+  // straight away and `output` is cleared so the caller can reuse its
+  // capacity; otherwise the contents are moved out and parked until the gap
+  // is filled.
+  void Complete(const Slot& slot, std::string& output);
+  void Complete(size_t sequence, std::string& output) { Complete(Slot{sequence}, output); }
+
+  // Replaces `slot` by the `count` slots below it, `slot` followed by 0 to
+  // count - 1, which are written in that order. A slot split into none is
+  // skipped. Its pieces may complete before the split is known.
+  void Split(const Slot& slot, size_t count);
+
+ private:
+  // writes and splits whatever is next in line
+  void Advance();
+  // moves next_ past a slot that has been written or skipped
+  void Next();
+
+  FILE* stream_{nullptr};
+  std::mutex mutex_;
+  std::map<Slot, std::string> parked_;
+  std::map<Slot, size_t> splits_;
+  Slot next_;
+  // slots below every split level next_ is in, the top level is unbounded
+  std::vector<size_t> counts_;
+};
+
+} // namespace gai
+
+#endif // GAI_PARALLEL_H_
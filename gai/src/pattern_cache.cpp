@@ -0,0 +1,119 @@
+#include <array>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#include "disk_entry.h"
+#include "pattern_cache.h"
+
+namespace gai {
+
+namespace fs = std::filesystem;
+
+// Bumped whenever the entry layout changes.
+constexpr std::string_view kMagic = "GAIPCR02";
+
+// Directory of the cache, empty while disabled.
+static std::string cache_directory;
+
+// Version of the running PCRE2 library, e.g. "10.42 2022-12-11".
+static std::string LibraryVersion() {
+  std::array<char, 64> version{};
+  pcre2_config(PCRE2_CONFIG_VERSION, version.data());
+  return version.data();
+}
+
+static bool ReadText(std::string_view& in, std::string& text) {
+  uint64_t size{0};
+  if (!ReadValue(in, size) || (in.size() < size)) return false;
+  text.assign(in.substr(0, size));
+  in.remove_prefix(size);
+  return true;
+}
+
+// Everything an entry has to agree on to be used, stored in front of it.
+static std::string EntryHeader(std::string_view key, uint32_t compile_options) {
+  static const std::string version = LibraryVersion();
+  std::string header{kMagic};
+  AppendValue(header, static_cast<uint32_t>(PCRE2_CODE_UNIT_WIDTH));
+  AppendValue(header, compile_options);
+  AppendValue(header, static_cast<uint64_t>(version.size()));
+  header.append(version);
+  AppendValue(header, static_cast<uint64_t>(key.size()));
+  header.append(key);
+  return header;
+}
+
+// Named after the hash of the header. The full header is compared on load, so
+// collisions only cost a recompile.
+static fs::path EntryPath(std::string_view header) {
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.pcre2", static_cast<unsigned long long>(Fnv1a(header)));
+  return fs::path{cache_directory} / name;
+}
+
+void EnablePatternCache(std::string_view directory) {
+  cache_directory = directory;
+  std::error_code ec;
+  if (!cache_directory.empty()) fs::create_directories(cache_directory, ec);
+}
+
+std::vector<CachedPattern> LoadCachedPatterns(std::string_view key, uint32_t compile_options) {
+  std::vector<CachedPattern> out;
+  if (cache_directory.empty()) return out;
+
+  const std::string header = EntryHeader(key, compile_options);
+  std::ifstream file{EntryPath(header), std::ios::binary};
+  if (!file) return out;
+  const std::string entry{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+  if (!std::string_view{entry}.starts_with(header)) return out;
+
+  std::string_view in{entry};
+  in.remove_prefix(header.size());
+  uint64_t count{0};
+  if (!ReadValue(in, count) || (count == 0) || (count > in.size())) return out;
+  out.resize(count);
+  for (CachedPattern& p : out) {
+    if (!ReadValue(in, p.id) || !ReadText(in, p.pattern)) return {};
+  }
+
+  // PCRE2 trusts serialized data blindly, a damaged entry must never reach it
+  uint64_t checksum{0};
+  if (!ReadValue(in, checksum) || (checksum != Fnv1a(in))) return {};
+  const auto* bytes = reinterpret_cast<const uint8_t*>(in.data());
+  if (pcre2_serialize_get_number_of_codes(bytes) != static_cast<int32_t>(count)) return {};
+  std::vector<pcre2_code*> codes(count, nullptr);
+  if (pcre2_serialize_decode(codes.data(), static_cast<int32_t>(count), bytes, nullptr) != static_cast<int32_t>(count)) {
+    return {};
+  }
+  for (size_t k = 0; k < count; ++k) out[k].code = codes[k];
+  return out;
+}
+
+void StoreCachedPatterns(std::string_view key, uint32_t compile_options, const std::vector<CachedPattern>& patterns) {
+  if (cache_directory.empty() || patterns.empty()) return;
+
+  const std::string header = EntryHeader(key, compile_options);
+  std::string entry = header;
+  AppendValue(entry, static_cast<uint64_t>(patterns.size()));
+  std::vector<const pcre2_code*> codes;
+  for (const CachedPattern& p : patterns) {
+    AppendValue(entry, p.id);
+    AppendValue(entry, static_cast<uint64_t>(p.pattern.size()));
+    entry.append(p.pattern);
+    codes.push_back(p.code);
+  }
+
+  uint8_t* bytes{nullptr};
+  PCRE2_SIZE size{0};
+  if (pcre2_serialize_encode(codes.data(), static_cast<int32_t>(codes.size()), &bytes, &size, nullptr) < 0) return;
+  const std::string_view serialized{reinterpret_cast<const char*>(bytes), size};
+  AppendValue(entry, Fnv1a(serialized));
+  entry.append(serialized);
+  pcre2_serialize_free(bytes);
+
+  WriteFileAtomically(EntryPath(header), entry);
+}
+
+} // namespace gai
@@ -0,0 +1,42 @@
+#ifndef GAI_PATTERN_CACHE_H_
+#define GAI_PATTERN_CACHE_H_
+
+#include <pcre2.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace gai {
+
+// Opt-in on-disk cache of compiled patterns. An entry is keyed by a caller
+// chosen text and the compile options and holds the pcre2_serialize_encode()
+// output of one or more patterns. JIT code cannot be serialized, patterns
+// loaded from the cache are JIT compiled again.
+//
+// Entries record the PCRE2 version that wrote them and are ignored (and
+// rewritten) when it differs from the running library or when decoding
+// fails. The cache is best effort: I/O errors fall back to a normal compile.
+
+// One compiled pattern of an entry. `id` is free for the caller to use.
+struct CachedPattern {
+  uint64_t id{0};
+  std::string pattern;
+  pcre2_code* code{nullptr};
+};
+
+// Enables the cache in `directory`, which is created when missing; an empty
+// directory disables it. Has to be called before patterns are compiled.
+void EnablePatternCache(std::string_view directory);
+
+// Returns the patterns stored under `key`, empty on a miss. The caller owns
+// the returned code.
+std::vector<CachedPattern> LoadCachedPatterns(std::string_view key, uint32_t compile_options);
+
+// Stores `patterns` under `key`. The code is not taken over.
+void StoreCachedPatterns(std::string_view key, uint32_t compile_options, const std::vector<CachedPattern>& patterns);
+
+} // namespace gai
+
+#endif // GAI_PATTERN_CACHE_H_
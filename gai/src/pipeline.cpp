@@ -0,0 +1,35 @@
+#include "pipeline.h"
+
+namespace gai {
+
+std::shared_ptr<const Patterns> CompilePipeline(const PipelineSpec& spec) {
+  const std::vector<std::string_view> filters(spec.filters.begin(), spec.filters.end());
+  const std::vector<std::string_view> excludes(spec.excludes.begin(), spec.excludes.end());
+  const std::vector<std::string_view> replacements(spec.replacements.begin(), spec.replacements.end());
+  const InvalidUtf8 policy = spec.invalid_utf8;
+  return std::make_shared<const Patterns>(Patterns{ParseFilters(filters, spec.jit, spec.utf, policy),
+                                                   ParseFilters(excludes, spec.jit, spec.utf, policy),
+                                                   ParseSubstitutions(replacements, spec.jit, spec.utf, policy),
+                                                   ParseRange(spec.range, spec.jit, spec.utf, policy)});
+}
+
+Pipeline::Pipeline(std::shared_ptr<const Patterns> patterns)
+  : patterns_{std::move(patterns)},
+    policy_{SubjectPolicy(patterns_->filters, patterns_->excludes, patterns_->replacements, patterns_->range)},
+    range_{patterns_->range} {
+  // the same conditions as for ProcessBuffer()
+  searchable_ = (!range_ || range_->IsLineBased()) && CandidateScanner::Searchable(patterns_->filters);
+}
+
+std::optional<std::string_view> Pipeline::Run(std::string_view line, bool validate, bool filtered) {
+  ++linenum_;
+  const Patterns& p = *patterns_;
+  const LineVerdict verdict =
+    SelectLine(p.filters, p.excludes, range_, line, linenum_, validate ? policy_ : std::nullopt, filtered);
+  if (verdict == LineVerdict::kFinished) done_ = true;
+  if (verdict != LineVerdict::kSelect) return std::nullopt;
+  if (p.replacements.empty()) return line;
+  return SubstituteAll(p.replacements, line, replacement_buffers_);
+}
+
+} // namespace gai
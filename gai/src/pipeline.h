@@ -0,0 +1,199 @@
+#ifndef GAI_PIPELINE_H_
+#define GAI_PIPELINE_H_
+
+#include <array>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "operation.h"
+#include "process.h"
+#include "simd.h"
+#include "stats.h"
+
+namespace gai {
+
+// What a pipeline runs, in the syntax of the command line: -f, -e, -r and
+// --range expressions, --no-jit, --utf and --utf-invalid.
+struct PipelineSpec {
+  std::vector<std::string> filters;
+  std::vector<std::string> excludes;
+  std::vector<std::string> replacements;
+  std::string range;
+  bool jit{true};
+  bool utf{false};
+  InvalidUtf8 invalid_utf8{InvalidUtf8::kBytes};
+};
+
+// Compiles `spec` once for any number of pipelines. Throws on expressions that
+// do not parse or compile, like the command line does. Settings that are
+// global (EnableStats(), EnablePatternCache()) are read here and have to be in
+// place before.
+std::shared_ptr<const Patterns> CompilePipeline(const PipelineSpec& spec);
+
+// Range, filters, excludes and replacements for embedding, run like Process()
+// runs them but pushed: bytes arrive in chunks that may split lines
+// anywhere, and every line that survives goes to a sink as soon as its
+// newline is seen.
+//
+// A sink is any callable `sink(std::string_view line, size_t linenum)`; it is
+// a template parameter, so the call is inlined into the line loop. The line
+// comes without its newline and is a view, valid during the call only: into
+// the pushed chunk for lines that lie inside it, into the pipeline for lines
+// that were split between chunks or rewritten by a replacement. Nothing is
+// copied otherwise.
+//
+// Invalid UTF-8 is handled as the patterns' own policy says (see
+// SubjectPolicy()), so pipelines of different specs can run side by side.
+//
+// The compiled patterns are shared and read only, a pipeline holds the state
+// of one stream (its range, line number and unfinished line). One pipeline per
+// thread is safe, any number of them at once; a single pipeline must not be
+// pushed to from two threads at the same time.
+class Pipeline {
+ public:
+  explicit Pipeline(const PipelineSpec& spec) : Pipeline(CompilePipeline(spec)) {}
+  explicit Pipeline(std::shared_ptr<const Patterns> patterns);
+
+  // Scans the lines `chunk` completes and keeps the unfinished one for the
+  // next call. Does nothing once the range is finished.
+  template <typename Sink>
+  void Push(std::string_view chunk, Sink&& sink);
+
+  // Ends the stream: scans an unterminated last line and starts over, the next
+  // Push() begins a new stream at line 1 with the range rewound.
+  template <typename Sink>
+  void Finish(Sink&& sink);
+
+  // True once no later line of the stream can be inside the range, pushing
+  // more of it is wasted.
+  bool Done() const { return done_; }
+  // Lines of the stream scanned so far.
+  size_t LineNumber() const { return linenum_; }
+
+ private:
+  // Lines Push() locates at once.
+  static constexpr size_t kBatchLines = 1024;
+
+  // Scans `lines`, which ends right after a newline.
+  template <typename Sink>
+  void ScanLines(std::string_view lines, Sink& sink);
+  // ScanLines() for filters that can be searched for in `lines` as a whole
+  // (see CandidateScanner): only the lines a filter may match are split off,
+  // the others are just counted.
+  template <typename Sink>
+  void SearchLines(std::string_view lines, Sink& sink);
+  // Runs the next line through SelectLine() and the replacements, returns
+  // what is handed to the sink. `validate` tells whether it still has to be
+  // checked for invalid UTF-8, `filtered` whether a filter is known to match it.
+  std::optional<std::string_view> Run(std::string_view line, bool validate, bool filtered = false);
+
+  std::shared_ptr<const Patterns> patterns_;
+  // policy the lines are validated with, see SubjectPolicy()
+  std::optional<InvalidUtf8> policy_;
+  bool searchable_{false};
+  std::optional<Range> range_;
+  size_t linenum_{0};
+  bool done_{false};
+  std::string pending_;  // bytes after the last newline pushed so far
+  std::array<std::string, 2> replacement_buffers_{std::string(1024, ' '), std::string(1024, ' ')};
+  std::array<size_t, kBatchLines> newlines_{};
+  CandidateScanner scanner_;
+};
+
+template <typename Sink>
+void Pipeline::Push(std::string_view chunk, Sink&& sink) {
+  if (done_ || chunk.empty()) return;
+  if (!pending_.empty()) {
+    // the unfinished line is completed first, it is the only line copied
+    const void* newline = std::memchr(chunk.data(), '\n', chunk.size());
+    if (!newline) {
+      pending_.append(chunk);
+      return;
+    }
+    const size_t length = static_cast<const char*>(newline) - chunk.data() + 1;
+    pending_.append(chunk.substr(0, length));
+    chunk.remove_prefix(length);
+    ScanLines(pending_, sink);
+    pending_.clear();
+    if (done_) return;
+  }
+  const size_t last_newline = chunk.rfind('\n');
+  if (last_newline != std::string_view::npos) {
+    ScanLines(chunk.substr(0, last_newline + 1), sink);
+    chunk.remove_prefix(last_newline + 1);
+  }
+  if (!done_) pending_.assign(chunk);
+}
+
+template <typename Sink>
+void Pipeline::Finish(Sink&& sink) {
+  if (!done_ && !pending_.empty()) {
+    pending_.push_back('\n');
+    ScanLines(pending_, sink);
+  }
+  pending_.clear();
+  range_ = patterns_->range;
+  linenum_ = 0;
+  done_ = false;
+}
+
+template <typename Sink>
+void Pipeline::ScanLines(std::string_view lines, Sink& sink) {
+  // validated at once, line by line only if that finds invalid UTF-8
+  const bool validate = policy_ && (ValidateUtf8(lines) != std::string_view::npos);
+  if (searchable_ && !validate) {
+    SearchLines(lines, sink);
+    return;
+  }
+  const size_t first_linenum = linenum_;
+  size_t pos = 0;
+  while ((pos < lines.size()) && !done_) {
+    const std::string_view rest = lines.substr(pos);
+    const size_t count = IndexNewlines(rest, newlines_.data(), newlines_.size());
+    size_t begin = 0;
+    for (size_t k = 0; (k < count) && !done_; ++k) {
+      const std::string_view line = rest.substr(begin, newlines_[k] - begin);
+      begin = newlines_[k] + 1;
+      if (const std::optional<std::string_view> out = Run(line, validate)) sink(*out, linenum_);
+    }
+    pos += begin;
+  }
+  CountInput(pos, linenum_ - first_linenum);
+}
+
+template <typename Sink>
+void Pipeline::SearchLines(std::string_view lines, Sink& sink) {
+  const size_t first_linenum = linenum_;
+  scanner_.Reset(patterns_->filters, lines);
+  size_t pos = 0;  // always at the start of a line
+  while (!done_) {
+    const std::optional<CandidateScanner::Line> hit = scanner_.Next(pos);
+    if (!hit) break;
+    // the range is moved past the lines that were skipped
+    linenum_ += CountNewlines(lines.substr(pos, hit->begin - pos));
+    if (range_) range_->Seek(linenum_);
+    if (const std::optional<std::string_view> out = Run(lines.substr(hit->begin, hit->end - hit->begin), false,
+                                                        hit->exact)) {
+      sink(*out, linenum_);
+    }
+    pos = hit->end + 1;
+  }
+  if (!done_) {
+    linenum_ += CountNewlines(lines.substr(pos));
+    pos = lines.size();
+    // a line number end among the lines skipped finishes the range as well
+    if (range_) {
+      range_->Seek(linenum_);
+      done_ = range_->IsFinished();
+    }
+  }
+  CountInput(pos, linenum_ - first_linenum);
+}
+
+} // namespace gai
+
+#endif // GAI_PIPELINE_H_
@@ -0,0 +1,489 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <limits>
+#include <string>
+
+#include "decompress.h"
+#include "process.h"
+#include "simd.h"
+#include "stats.h"
+
+namespace gai {
+
+// Lines Process() asks the input for at once, see there.
+constexpr size_t kFirstBatchLines = 16;
+constexpr size_t kMaxBatchLines = 4096;
+
+std::string_view ReplaceInvalidUtf8(std::string_view line, size_t invalid, std::string& scratch) {
+  scratch.clear();
+  while (invalid != std::string_view::npos) {
+    scratch.append(line.substr(0, invalid)).append("\xEF\xBF\xBD");
+    line.remove_prefix(invalid + 1);
+    invalid = ValidateUtf8(line);
+  }
+  scratch.append(line);
+  return scratch;
+}
+
+std::optional<InvalidUtf8> SubjectPolicy(const Pcre2PatternSet& filters,
+                                         const Pcre2PatternSet& excludes,
+                                         const std::vector<Pcre2Substitution>& replacements,
+                                         const std::optional<Range>& range) {
+  std::optional<InvalidUtf8> policy;
+  auto consider = [&policy](const Pcre2Compiled& re) {
+    if (!policy && SubjectsValidated(re)) policy = re.invalid_utf8;
+  };
+  for (const Pcre2Regex& r : filters.matchers) consider(r.re);
+  for (const Pcre2Regex& r : excludes.matchers) consider(r.re);
+  for (const Pcre2Substitution& r : replacements) consider(r.re);
+  if (range) {
+    if (const auto* start = std::get_if<SharedRegex>(&range->start)) consider((*start)->re);
+    if (const auto* end = std::get_if<SharedRegex>(&range->end)) consider((*end)->re);
+  }
+  return policy;
+}
+
+// Applies the invalid UTF-8 `policy` to a line that was not validated yet.
+// Returns false for a line that is not to be matched, points `line` at a
+// repaired copy if it needs one.
+static bool ValidateLine(std::string_view& line, InvalidUtf8 policy) {
+  const size_t invalid = ValidateUtf8(line);
+  if (invalid == std::string_view::npos) return true;
+  if (policy == InvalidUtf8::kSkip) return false;
+  thread_local std::string repaired;
+  line = ReplaceInvalidUtf8(line, invalid, repaired);
+  return true;
+}
+
+// Replacements for a line that is printed, match or context.
+static void EmitLine(const std::vector<Pcre2Substitution>& replacements,
+                     OutputSink& out, std::string_view line, size_t linenum, bool context = false) {
+  thread_local std::array<std::string, 2> replacement_buffers{std::string(1024, ' '), std::string(1024, ' ')};
+  const bool replace = !replacements.empty() && out.PrintsLines();
+  // context lines come from the input's history as they were read, a
+  // replacement that skips the UTF check must not see invalid UTF-8
+  if (replace && context &&
+      std::any_of(replacements.begin(), replacements.end(), [](const Pcre2Substitution& r) {
+        return SubjectsValidated(r.re);
+      })) {
+    thread_local std::string repaired;
+    if (const size_t invalid = ValidateUtf8(line); invalid != std::string_view::npos) {
+      line = ReplaceInvalidUtf8(line, invalid, repaired);
+    }
+  }
+  out.Emit(replace ? SubstituteAll(replacements, line, replacement_buffers) : line, linenum, context);
+}
+
+// Prints every match of the filters in `line`, left to right and without
+// overlaps, as the capture groups the sink asks for (-o). Empty matches are
+// skipped. The groups are views into `line`, read from the match data of the
+// filter that matched.
+static void EmitMatches(const Pcre2PatternSet& filters, OutputSink& out, std::string_view line, size_t linenum) {
+  const std::vector<Pcre2Regex>& matchers = filters.matchers;
+  // next match of every filter at or after `pos`, searched again once `pos`
+  // moves past its start; a filter's match data still describes its match
+  thread_local std::vector<std::optional<MatchSpan>> next;
+  thread_local std::vector<std::string_view> groups;
+  constexpr MatchSpan kNotSearched{std::string_view::npos, std::string_view::npos};
+  next.assign(matchers.size(), kNotSearched);
+  size_t pos = 0;
+  while (pos <= line.size()) {
+    size_t first = matchers.size();
+    for (size_t k = 0; k < matchers.size(); ++k) {
+      std::optional<MatchSpan>& span = next[k];
+      if (span && ((span->start == kNotSearched.start) || (span->start < pos))) span = Search(matchers[k], line, pos);
+      if (span && ((first == matchers.size()) || (span->start < next[first]->start))) first = k;
+    }
+    if (first == matchers.size()) break;
+
+    const MatchSpan match = *next[first];
+    if (match.end > match.start) {
+      groups.clear();
+      for (const size_t group : out.Groups()) {
+        const std::optional<MatchSpan> captured = CapturedGroup(matchers[first], group);
+        groups.push_back(captured ? line.substr(captured->start, captured->end - captured->start) : line.substr(0, 0));
+      }
+      out.EmitMatch(groups, linenum);
+      pos = match.end;
+    } else {
+      // past an empty match, onto the start of the next character
+      pos = match.end + 1;
+      while ((pos < line.size()) && ((static_cast<unsigned char>(line[pos]) & 0xC0) == 0x80)) ++pos;
+    }
+  }
+}
+
+// Prints a line SelectLine() selected, with its replacements or as its
+// matches (-o).
+static void EmitSelected(const Pcre2PatternSet& filters,
+                         const std::vector<Pcre2Substitution>& replacements,
+                         OutputSink& out, std::string_view line, size_t linenum) {
+  if (out.PrintsMatches()) {
+    EmitMatches(filters, out, line, linenum);
+    return;
+  }
+  EmitLine(replacements, out, line, linenum);
+}
+
+static bool InRange(std::optional<Range>& range, std::string_view line, size_t linenum) {
+  if (!range) return true;
+  range->Seek(linenum - 1);
+  return range->IsStartReached(line, linenum) && !range->IsEndReached(line, linenum);
+}
+
+LineVerdict SelectLine(const Pcre2PatternSet& filters,
+                       const Pcre2PatternSet& excludes,
+                       std::optional<Range>& range, std::string_view& line,
+                       size_t linenum, std::optional<InvalidUtf8> validate, bool filtered) {
+  if (validate && !ValidateLine(line, *validate)) return LineVerdict::kSkip;
+  if (range) {
+    if (!range->IsStartReached(line, linenum)) return LineVerdict::kSkip;
+    if (range->IsEndReached(line, linenum)) return range->IsFinished() ? LineVerdict::kFinished : LineVerdict::kSkip;
+  }
+  if (!filtered && !filters.empty() && !FindAny(filters, line)) return LineVerdict::kSkip;
+  if (!excludes.empty() && FindAny(excludes, line)) return LineVerdict::kSkip;
+  return LineVerdict::kSelect;
+}
+
+bool CandidateScanner::Searchable(const Pcre2PatternSet& filters) {
+  return !filters.empty() && std::all_of(filters.matchers.begin(), filters.matchers.end(), [](const Pcre2Regex& r) {
+    return r.re.buffer_searchable || !r.re.literal.empty();
+  });
+}
+
+void CandidateScanner::Reset(const Pcre2PatternSet& filters, std::string_view buffer) {
+  constexpr size_t kNotSearched = std::numeric_limits<size_t>::max();
+  filters_ = &filters;
+  buffer_ = buffer;
+  candidates_.assign(filters.matchers.size(), Candidate{kNotSearched, kNotSearched, false});
+}
+
+std::optional<CandidateScanner::Line> CandidateScanner::Next(size_t pos) {
+  constexpr size_t kNotSearched = std::numeric_limits<size_t>::max();
+  const std::vector<Pcre2Regex>& matchers = filters_->matchers;
+  std::optional<Candidate> first;
+  for (size_t k = 0; k < matchers.size(); ++k) {
+    std::optional<Candidate>& c = candidates_[k];
+    if (c && ((c->start == kNotSearched) || (c->start < pos))) {
+      const Pcre2Regex& filter = matchers[k];
+      if (!filter.re.literal.empty()) {
+        const size_t at = FindLiteral(buffer_.substr(pos), filter.re.literal);
+        c = (at == std::string_view::npos) ? std::nullopt : std::optional<Candidate>{{pos + at, pos + at, false}};
+      } else {
+        const std::optional<MatchSpan> span = Search(filter, buffer_, pos);
+        c = span ? std::optional<Candidate>{{span->start, span->end, true}} : std::nullopt;
+      }
+    }
+    if (c && (!first || (c->start < first->start))) first = c;
+  }
+  if (!first) return std::nullopt;
+
+  // a match starting on a newline belongs to the line that newline ends
+  const char* const data = buffer_.data();
+  const void* begin = memrchr(data + pos, '\n', first->start - pos);
+  const void* end = std::memchr(data + first->start, '\n', buffer_.size() - first->start);
+  Line line;
+  line.begin = begin ? static_cast<const char*>(begin) - data + 1 : pos;
+  line.end = end ? static_cast<const char*>(end) - data : buffer_.size();
+  line.exact = first->exact && (first->end <= line.end);
+  return line;
+}
+
+ContextPrinter::ContextPrinter(const std::vector<Pcre2Substitution>& replacements, OutputSink& out, size_t linenum)
+  : replacements_{replacements}, out_{out}, printed_{linenum}, floor_{linenum + 1} {}
+
+void ContextPrinter::Barrier(size_t linenum) {
+  Floor(linenum + 1);
+  after_left_ = 0;
+}
+
+size_t ContextPrinter::BeforeCount(size_t linenum) const {
+  const size_t back = (linenum > out_.Before()) ? linenum - out_.Before() : 1;
+  return linenum - std::max({back, floor_, printed_ + 1});
+}
+
+void ContextPrinter::Match(std::string_view line, size_t linenum, const std::vector<std::string_view>& before) {
+  const size_t count = BeforeCount(linenum);
+  if (any_ && (linenum - count > printed_ + 1)) out_.EmitSeparator();
+  for (size_t k = count; k > 0; --k) EmitLine(replacements_, out_, before[k - 1], linenum - k, true);
+  EmitLine(replacements_, out_, line, linenum);
+  printed_ = linenum;
+  after_left_ = out_.After();
+  any_ = true;
+}
+
+void ContextPrinter::NonMatch(std::string_view line, size_t linenum) {
+  if (after_left_ == 0) return;
+  --after_left_;
+  EmitLine(replacements_, out_, line, linenum, true);
+  printed_ = linenum;
+}
+
+static bool IsMatch(const Pcre2PatternSet& filters, const Pcre2PatternSet& excludes, std::string_view line) {
+  return (filters.empty() || FindAny(filters, line)) && (excludes.empty() || !FindAny(excludes, line));
+}
+
+// ProcessWithContext(), `validate` is the policy the lines still have to be
+// checked for invalid UTF-8 with, nullopt if they need no check. The lines
+// before a match come from the input's history, which keeps views (or
+// copies, for inputs that reuse their buffer).
+static void ProcessWithContext(const Pcre2PatternSet& filters,
+                               const Pcre2PatternSet& excludes,
+                               const std::vector<Pcre2Substitution>& replacements,
+                               OutputSink& out,
+                               std::optional<Range>& range, InputBase* const input,
+                               size_t linenum, ContextPrinter& printer,
+                               std::optional<InvalidUtf8> validate) {
+  const size_t first_linenum = linenum;
+  thread_local std::vector<std::string_view> before;
+  while (std::optional<std::string_view> line_opt = input->GetLine()) {
+    ++linenum;
+    std::string_view line = line_opt.value();
+    // context does not cross a line that is skipped for invalid UTF-8
+    if (validate && !ValidateLine(line, *validate)) {
+      printer.Barrier(linenum);
+      continue;
+    }
+    if (range && (!range->IsStartReached(line, linenum) || range->IsEndReached(line, linenum))) {
+      if (range->IsFinished()) break;
+      printer.Barrier(linenum);
+      continue;
+    }
+    if (IsMatch(filters, excludes, line)) {
+      before.clear();
+      for (size_t k = 1; k <= printer.BeforeCount(linenum); ++k) before.push_back(input->Previous(k));
+      printer.Match(line, linenum, before);
+      if (out.Done()) break;
+    } else {
+      printer.NonMatch(line, linenum);
+    }
+  }
+  CountInput(0, linenum - first_linenum);
+}
+
+void ProcessWithContext(const Pcre2PatternSet& filters,
+                        const Pcre2PatternSet& excludes,
+                        const std::vector<Pcre2Substitution>& replacements,
+                        OutputSink& out,
+                        std::optional<Range>& range, InputBase* const input,
+                        size_t linenum, ContextPrinter& printer) {
+  StageTimer timer(Stage::kMatch);
+  ProcessWithContext(filters, excludes, replacements, out, range, input, linenum, printer,
+                     SubjectPolicy(filters, excludes, replacements, range));
+}
+
+// Process(), `validate` is the policy the lines still have to be checked for
+// invalid UTF-8 with, nullopt if they need no check.
+static void ProcessLines(const Pcre2PatternSet& filters,
+                         const Pcre2PatternSet& excludes,
+                         const std::vector<Pcre2Substitution>& replacements,
+                         OutputSink& out,
+                         std::optional<Range>& range, InputBase* const input,
+                         size_t linenum, std::optional<InvalidUtf8> validate) {
+  StageTimer timer(Stage::kMatch);
+  if (out.HasContext()) {
+    ContextPrinter printer(replacements, out, linenum);
+    input->KeepPrevious(out.Before());
+    ProcessWithContext(filters, excludes, replacements, out, range, input, linenum, printer, validate);
+    input->KeepPrevious(0);
+    return;
+  }
+  // Lines come in batches, so the input is called once per batch and the
+  // work per line is a loop over a flat array. Batches start small and grow,
+  // so stopping early (-l, -m, a range end) reads little more than needed;
+  // the lines of a batch after the one stopped at are given back.
+  thread_local std::vector<std::string_view> batch(kMaxBatchLines);
+  const size_t first_linenum = linenum;
+  size_t batch_size = kFirstBatchLines;
+  bool stop = false;
+  while (!stop) {
+    const size_t count = input->GetLines(batch.data(), batch_size);
+    if (count == 0) break;
+    batch_size = std::min(2 * batch_size, kMaxBatchLines);
+    // the lines of a batch follow each other in one buffer and are validated
+    // at once, one by one only if that finds invalid UTF-8
+    const std::string_view span(batch[0].data(), batch[count - 1].data() + batch[count - 1].size() - batch[0].data());
+    const bool validate_lines = validate && (ValidateUtf8(span) != std::string_view::npos);
+    for (size_t k = 0; (k < count) && !stop; ++k) {
+      ++linenum;
+      std::string_view line = batch[k];
+      const LineVerdict verdict =
+        SelectLine(filters, excludes, range, line, linenum, validate_lines ? validate : std::nullopt);
+      if (verdict == LineVerdict::kFinished) {
+        // nothing after a line number end is printed, the rest is not read
+        stop = true;
+        input->Unread(count - k - 1);
+        continue;
+      }
+      if (verdict == LineVerdict::kSkip) continue;
+      EmitSelected(filters, replacements, out, line, linenum);
+      stop = out.Done();
+      if (stop) input->Unread(count - k - 1);
+    }
+  }
+  CountInput(0, linenum - first_linenum);
+}
+
+void Process(const Pcre2PatternSet& filters,
+             const Pcre2PatternSet& excludes,
+             const std::vector<Pcre2Substitution>& replacements,
+             OutputSink& out,
+             std::optional<Range>& range, InputBase* const input,
+             size_t linenum) {
+  ProcessLines(filters, excludes, replacements, out, range, input, linenum,
+               SubjectPolicy(filters, excludes, replacements, range));
+}
+
+void ProcessBuffer(const Pcre2PatternSet& filters,
+                   const Pcre2PatternSet& excludes,
+                   const std::vector<Pcre2Substitution>& replacements,
+                   OutputSink& out,
+                   std::optional<Range>& range, std::string_view buffer,
+                   size_t linenum) {
+  const RangeSlice slice = SliceToRange(range, buffer, linenum);
+  buffer = slice.buffer;
+  linenum = slice.linenum;
+
+  // filters with a required literal are found through it and confirmed per
+  // line, which is exact for any pattern
+  // a buffer with invalid UTF-8 is gone through line by line, the policy
+  // applies to the lines that hold it; so is one that is likely left early,
+  // where lines are validated a batch at a time as they are read
+  const std::optional<InvalidUtf8> policy = SubjectPolicy(filters, excludes, replacements, range);
+  const bool valid = !policy || (!out.StopsEarly() && (ValidateUtf8(buffer) == std::string_view::npos));
+  const bool searchable = valid && (!range || range->IsLineBased()) && CandidateScanner::Searchable(filters);
+  if (!searchable) {
+    CountInput(buffer.size(), 0);
+    InputMemMappedFile input(buffer.data(), buffer.data() + buffer.size());
+    ProcessLines(filters, excludes, replacements, out, range, &input, linenum,
+                 valid ? std::nullopt : policy);
+    return;
+  }
+  StageTimer timer(Stage::kMatch);
+
+  thread_local CandidateScanner scanner;
+  scanner.Reset(filters, buffer);
+
+  // with context the lines before a match are found by walking back from
+  // it, the lines after it are looked at one by one
+  const bool context = out.HasContext();
+  ContextPrinter printer(replacements, out, linenum);
+  if (range && std::holds_alternative<size_t>(range->start)) printer.Floor(std::get<size_t>(range->start));
+  thread_local std::vector<std::string_view> before;
+
+  const size_t first_linenum = linenum;
+  const char* const data = buffer.data();
+  size_t pos = 0;            // always at the start of a line
+  size_t counted_pos = 0;    // newlines in front of this offset are added to `linenum`
+  while (pos < buffer.size()) {
+    if (context && printer.WantsAfter()) {
+      const char* line_end = static_cast<const char*>(std::memchr(data + pos, '\n', buffer.size() - pos));
+      if (!line_end) line_end = data + buffer.size();
+      const std::string_view line(data + pos, line_end - (data + pos));
+      pos = (line_end - data) + 1;
+      counted_pos = pos;
+      ++linenum;
+      if (!InRange(range, line, linenum)) {
+        printer.Barrier(linenum);
+      } else if (IsMatch(filters, excludes, line)) {
+        before.clear();
+        printer.Match(line, linenum, before);
+        if (out.Done()) break;
+      } else {
+        printer.NonMatch(line, linenum);
+      }
+      continue;
+    }
+
+    const std::optional<CandidateScanner::Line> hit = scanner.Next(pos);
+    if (!hit) break;
+    std::string_view line = buffer.substr(hit->begin, hit->end - hit->begin);
+    pos = hit->end + 1;
+
+    linenum += CountNewlines(buffer.substr(counted_pos, hit->begin - counted_pos)) + 1;
+    counted_pos = pos;
+
+    if (range) range->Seek(linenum - 1);
+    const LineVerdict verdict = SelectLine(filters, excludes, range, line, linenum, std::nullopt, hit->exact);
+    if (verdict == LineVerdict::kFinished) break;
+    if (verdict == LineVerdict::kSkip) continue;
+    if (!context) {
+      EmitSelected(filters, replacements, out, line, linenum);
+      if (out.Done()) break;
+      continue;
+    }
+
+    before.clear();
+    const char* end = data + hit->begin;
+    for (size_t k = printer.BeforeCount(linenum); k > 0; --k) {
+      const char* begin = static_cast<const char*>(memrchr(data, '\n', end - 1 - data));
+      begin = begin ? begin + 1 : data;
+      before.emplace_back(begin, end - 1 - begin);
+      end = begin;
+    }
+    printer.Match(line, linenum, before);
+    if (out.Done()) break;
+  }
+
+  if (StatsEnabled()) {
+    // only lines around matches were split off, the others are counted now,
+    // up to where the scan stopped
+    const size_t end = out.Done() ? std::min(pos, buffer.size()) : buffer.size();
+    size_t lines = linenum - first_linenum;
+    if (counted_pos < end) {
+      lines += CountNewlines(buffer.substr(counted_pos, end - counted_pos)) +
+               ((end == buffer.size()) && (buffer.back() != '\n'));
+    }
+    CountInput(end, lines);
+  }
+}
+
+RangeSlice SliceToRange(const std::optional<Range>& range, std::string_view buffer, size_t linenum,
+                        const LineIndex* index) {
+  if (!range) return {buffer, linenum};
+  // offset just past `lines` more lines after offset `from`, which follows
+  // line `from_linenum`; counted from there or looked up in the index
+  auto skip_lines = [&](size_t from, size_t from_linenum, size_t lines) {
+    if (index) return index->SkipLines(buffer, from_linenum - linenum + lines);
+    const size_t skip = SkipLines(buffer.substr(from), lines);
+    return (skip == std::string_view::npos) ? skip : from + skip;
+  };
+  size_t begin = 0;
+  size_t first = linenum;
+  if (const size_t start = range->PendingStart(); start > linenum + 1) {
+    begin = skip_lines(0, linenum, start - 1 - linenum);
+    if (begin == std::string_view::npos) {
+      CountInput(buffer.size(), StatsEnabled() ? CountNewlines(buffer) : 0);
+      return {buffer.substr(buffer.size()), linenum};
+    }
+    CountInput(begin, start - 1 - linenum);
+    first = start - 1;
+  }
+  size_t end_offset = buffer.size();
+  if (const size_t end = range->EndLine(); end > 0) {
+    if (end <= first + 1) return {buffer.substr(begin, 0), first};
+    // with more lines to go than bytes left the end is not in the buffer
+    if (end - 1 - first <= buffer.size() - begin) {
+      end_offset = std::min(skip_lines(begin, first, end - 1 - first), buffer.size());
+    }
+  }
+  return {buffer.substr(begin, end_offset - begin), first};
+}
+
+void ProcessContents(const Pcre2PatternSet& filters,
+                     const Pcre2PatternSet& excludes,
+                     const std::vector<Pcre2Substitution>& replacements,
+                     OutputSink& out,
+                     std::optional<Range>& range, std::string_view contents) {
+  const Compression compression = DetectCompression(contents);
+  if (compression == Compression::kNone) {
+    ProcessBuffer(filters, excludes, replacements, out, range, contents);
+    return;
+  }
+  CountInput(contents.size(), 0);
+  DecompressingInput input(contents, compression);
+  Process(filters, excludes, replacements, out, range, &input);
+}
+
+} // namespace gai
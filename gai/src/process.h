@@ -0,0 +1,199 @@
+#ifndef GAI_PROCESS_H_
+#define GAI_PROCESS_H_
+
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "input.h"
+#include "line_index.h"
+#include "operation.h"
+#include "output.h"
+#include "regex.h"
+
+namespace gai {
+
+// Everything compiled from the command line. The patterns can be shared by
+// threads, only the range state changes while lines are processed and needs a
+// copy per thread.
+struct Patterns {
+  Pcre2PatternSet filters;
+  Pcre2PatternSet excludes;
+  std::vector<Pcre2Substitution> replacements;
+  std::optional<Range> range;
+};
+
+// Prints matches together with the lines around them (see
+// OutputSink::SetContext). Windows that overlap or touch are merged, the
+// others are separated by "--". Context never reaches back over a line that
+// was printed already or lies outside the range. A printer that outlives one
+// call carries the context of a stream scanned in pieces (see
+// ProcessWithContext()).
+class ContextPrinter {
+ public:
+  ContextPrinter(const std::vector<Pcre2Substitution>& replacements, OutputSink& out, size_t linenum = 0);
+
+  // Context starts at `linenum` or later.
+  void Floor(size_t linenum) { floor_ = std::max(floor_, linenum); }
+  // `linenum` is outside the range, context does not cross it.
+  void Barrier(size_t linenum);
+
+  // Number of lines printed in front of a match on `linenum`.
+  size_t BeforeCount(size_t linenum) const;
+
+  // Prints a match after its before context, `before[k - 1]` is the line `k`
+  // lines before it and holds at least BeforeCount() lines.
+  void Match(std::string_view line, size_t linenum, const std::vector<std::string_view>& before);
+
+  // A line that is in range but no match, printed while after context is left.
+  bool WantsAfter() const { return after_left_ > 0; }
+  void NonMatch(std::string_view line, size_t linenum);
+
+ private:
+  const std::vector<Pcre2Substitution>& replacements_;
+  OutputSink& out_;
+  size_t printed_{0};  // last line printed
+  size_t floor_{1};    // first line context may start at
+  size_t after_left_{0};
+  bool any_{false};
+};
+
+// Runs range, filters, excludes and replacements over every line of `input`
+// and hands surviving lines to `out`. Line numbers continue from `linenum`,
+// which lets a caller resume numbering in the middle of a file. Reading stops
+// as soon as `out` is done with the file (-l, -m).
+void Process(const Pcre2PatternSet& filters,
+             const Pcre2PatternSet& excludes,
+             const std::vector<Pcre2Substitution>& replacements,
+             OutputSink& out,
+             std::optional<Range>& range, InputBase* const input,
+             size_t linenum = 0);
+
+// Process() with context for a stream that arrives in pieces, like a
+// followed file: `printer` carries the after context still owed from one
+// call to the next and `input` the lines before context may need, so both
+// have to outlive the calls. The input keeps Previous() lines as set up by
+// the caller (see InputPieces).
+void ProcessWithContext(const Pcre2PatternSet& filters,
+                        const Pcre2PatternSet& excludes,
+                        const std::vector<Pcre2Substitution>& replacements,
+                        OutputSink& out,
+                        std::optional<Range>& range, InputBase* const input,
+                        size_t linenum, ContextPrinter& printer);
+
+// Outcome of the line stages for one line, see SelectLine().
+enum class LineVerdict {
+  kSkip,      // left out by the UTF-8 policy, the range, the filters or the excludes
+  kSelect,    // goes to the output
+  kFinished,  // a line number end finished the range, no later line is selected
+};
+
+// The stages every line goes through, in Process(), ProcessBuffer() and
+// Pipeline alike: the invalid UTF-8 policy `validate` (nullopt for a line
+// that needs no check; a repaired line is pointed at a copy), the range, the
+// filters unless `filtered` tells that one is known to match, and the
+// excludes. Replacements are left to the caller.
+LineVerdict SelectLine(const Pcre2PatternSet& filters,
+                       const Pcre2PatternSet& excludes,
+                       std::optional<Range>& range, std::string_view& line,
+                       size_t linenum, std::optional<InvalidUtf8> validate, bool filtered = false);
+
+// Finds the lines of a buffer that its filters may match without splitting
+// the buffer into lines: the filters are run over the buffer as a whole,
+// through their required literal if they have one. The next hit of every
+// filter is kept and only searched for again once the scan has moved past
+// it.
+class CandidateScanner {
+ public:
+  // A line that a filter may match, `end` is the offset of its newline (the
+  // buffer size for an unterminated last line). Only a regex match inside
+  // the line is `exact`; literal hits and matches that spill over a newline
+  // only nominate it.
+  struct Line {
+    size_t begin{0};
+    size_t end{0};
+    bool exact{false};
+  };
+
+  // Whether `filters` can be scanned for like this: there is at least one and
+  // every one is buffer searchable or has a required literal.
+  static bool Searchable(const Pcre2PatternSet& filters);
+
+  // Starts a scan of `buffer`, which has to stay alive until the next Reset().
+  void Reset(const Pcre2PatternSet& filters, std::string_view buffer);
+
+  // Next line at or after `pos`, the start of a line, that a filter may match.
+  std::optional<Line> Next(size_t pos);
+
+ private:
+  struct Candidate {
+    size_t start{0};
+    size_t end{0};
+    bool exact{false};
+  };
+
+  const Pcre2PatternSet* filters_{nullptr};
+  std::string_view buffer_;
+  // next hit of every filter, nullopt once it has none left
+  std::vector<std::optional<Candidate>> candidates_;
+};
+
+// Same as Process() over the lines of a memory mapped `buffer`, but the
+// filters are run over the whole buffer and only the lines they hit are
+// materialised; regions without a match are never split into lines. Falls
+// back to line by line processing when there are no filters, a filter is
+// neither buffer searchable nor has a required literal, or the range has a
+// regex bound. Filters with a literal are located through it and confirmed
+// on the enclosing line.
+void ProcessBuffer(const Pcre2PatternSet& filters,
+                   const Pcre2PatternSet& excludes,
+                   const std::vector<Pcre2Substitution>& replacements,
+                   OutputSink& out,
+                   std::optional<Range>& range, std::string_view buffer,
+                   size_t linenum = 0);
+
+// Part of a buffer that a range can reach, see SliceToRange().
+struct RangeSlice {
+  std::string_view buffer;
+  // line in front of `buffer`
+  size_t linenum{0};
+};
+
+// Cuts off what `range` cannot reach from `buffer`, which starts after line
+// `linenum`: the lines in front of a line number start that is still ahead
+// and, for a line based range, the lines from its line number end on. Lines
+// are counted with SkipLines(), nothing is split into lines, so extracting a
+// slice costs a newline scan up to its end. A buffer that ends before the
+// start leaves an empty slice. With the line `index` of `buffer` the scan
+// starts from the closest entry instead.
+RangeSlice SliceToRange(const std::optional<Range>& range, std::string_view buffer, size_t linenum,
+                        const LineIndex* index = nullptr);
+
+// Policy for invalid UTF-8 that subjects of these patterns are validated
+// with before they are matched (see InvalidUtf8): that of the first pattern
+// whose match calls skip PCRE2's check, nullopt if none does. Patterns
+// compiled together share one policy.
+std::optional<InvalidUtf8> SubjectPolicy(const Pcre2PatternSet& filters,
+                                         const Pcre2PatternSet& excludes,
+                                         const std::vector<Pcre2Substitution>& replacements,
+                                         const std::optional<Range>& range);
+
+// `line` with every byte that does not start a valid UTF-8 sequence replaced
+// by U+FFFD, written to `scratch`. `invalid` is the first such byte, as
+// ValidateUtf8() found it.
+std::string_view ReplaceInvalidUtf8(std::string_view line, size_t invalid, std::string& scratch);
+
+// Entry point for the contents of a file: gzip and zstd data, recognised by
+// its magic bytes, is decompressed on a reader thread and processed line by
+// line, anything else goes to ProcessBuffer().
+void ProcessContents(const Pcre2PatternSet& filters,
+                     const Pcre2PatternSet& excludes,
+                     const std::vector<Pcre2Substitution>& replacements,
+                     OutputSink& out,
+                     std::optional<Range>& range, std::string_view contents);
+
+} // namespace gai
+
+#endif // GAI_PROCESS_H_
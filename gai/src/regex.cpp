@@ -1,5 +1,14 @@
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <mutex>
 #include <stdexcept>
+#include <utility>
+#include "pattern_cache.h"
 #include "regex.h"
+#include "simd.h"
+#include "stats.h"
 #include "format.h"
 
 namespace gai {
@@ -32,26 +41,365 @@ Pcre2Compiled::~Pcre2Compiled() {
   if (p) pcre2_code_free(p);
 }
 
-Pcre2Regex::Pcre2Regex(Pcre2Compiled&& re_, pcre2_match_data* m) : re{std::move(re_)}, match_data{m} {}
+// Hands out the ids of live patterns. Freed ids are reused so the per-thread
+// match data caches stay as small as the number of patterns alive at once.
+class PatternIds {
+ public:
+  // Never destroyed: patterns in static storage of an embedding program can
+  // be destroyed after it at exit and still release their ids.
+  static PatternIds& Instance() {
+    static PatternIds* ids = new PatternIds;
+    return *ids;
+  }
+
+  size_t Acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.empty()) return next_++;
+    const size_t id = free_.back();
+    free_.pop_back();
+    return id;
+  }
+
+  void Release(size_t id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(id);
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<size_t> free_;
+  size_t next_{0};
+};
+
+// Match data of the current thread, indexed by pattern id. An entry left
+// behind by a destroyed pattern is reused by the next owner of the id if its
+// ovector is large enough.
+struct MatchDataCache {
+  struct Entry {
+    pcre2_match_data* match_data{nullptr};
+    uint32_t ovector_pairs{0};
+  };
+  std::vector<Entry> entries;
+
+  MatchDataCache() = default;
+  ~MatchDataCache() {
+    for (Entry& e : entries) {
+      if (e.match_data) pcre2_match_data_free(e.match_data);
+    }
+  }
+
+  MatchDataCache(const MatchDataCache&) = delete;
+  MatchDataCache& operator=(const MatchDataCache&) = delete;
+};
+thread_local MatchDataCache thread_local_match_data;
+
+static pcre2_match_data* MatchData(const Pcre2Regex& regex) {
+  std::vector<MatchDataCache::Entry>& entries = thread_local_match_data.entries;
+  if (regex.id >= entries.size()) entries.resize(regex.id + 1);
+
+  MatchDataCache::Entry& entry = entries[regex.id];
+  if (entry.ovector_pairs < regex.ovector_pairs) {
+    if (entry.match_data) pcre2_match_data_free(entry.match_data);
+    entry = {pcre2_match_data_create(regex.ovector_pairs, nullptr), regex.ovector_pairs};
+    if (!entry.match_data) {
+      entry.ovector_pairs = 0;
+      throw std::runtime_error("Unable to allocate PCRE2 match data\n");
+    }
+  }
+  return entry.match_data;
+}
+
+Pcre2Regex::Pcre2Regex(Pcre2Compiled&& re_) : re{std::move(re_)}, id{PatternIds::Instance().Acquire()} {
+  uint32_t captures{0};
+  if (re.p && (pcre2_pattern_info(re.p, PCRE2_INFO_CAPTURECOUNT, &captures) == 0)) ovector_pairs = captures + 1;
+}
+
+Pcre2Regex& Pcre2Regex::operator=(Pcre2Regex&& other) noexcept {
+  if (this != &other) {
+    re = std::move(other.re);
+    if (id != kNoId) PatternIds::Instance().Release(id);
+    id = std::exchange(other.id, kNoId);
+    ovector_pairs = other.ovector_pairs;
+  }
+  return *this;
+}
 
 Pcre2Regex::~Pcre2Regex() {
-  if (match_data) pcre2_match_data_free(match_data);
+  if (id != kNoId) PatternIds::Instance().Release(id);
 }
 
 Pcre2Substitution::Pcre2Substitution(Pcre2Compiled&& re_, std::string_view sub_) : re{std::move(re_)},
                                                                                    substitute_pattern{sub_} {}
 
-Pcre2Compiled Compile(std::string_view pattern, bool jit_compile, bool enable_utf) {
+// Shorter literals reject too few lines to pay for the extra scan.
+constexpr size_t kMinLiteralLength = 2;
+
+// Returns the index one past the character class starting at `i`.
+static size_t SkipClass(std::string_view pattern, size_t i) {
+  const size_t n = pattern.size();
+  size_t j = i + 1;
+  if ((j < n) && (pattern[j] == '^')) ++j;
+  if ((j < n) && (pattern[j] == ']')) ++j; // a leading ']' is literal
+  while ((j < n) && (pattern[j] != ']')) {
+    if (pattern[j] == '\\') {
+      j += 2;
+    } else if ((pattern[j] == '[') && (j + 1 < n) && (pattern[j + 1] == ':')) {
+      const size_t e = pattern.find(":]", j + 2);
+      j = (e == std::string_view::npos) ? j + 1 : e + 2;
+    } else {
+      ++j;
+    }
+  }
+  return std::min(j + 1, n);
+}
+
+// Returns the index one past the (non literal) escape sequence starting at `i`.
+static size_t SkipEscape(std::string_view pattern, size_t i) {
+  const size_t n = pattern.size();
+  const char e = (i + 1 < n) ? pattern[i + 1] : '\0';
+  size_t j = i + 2;
+  if (j >= n) return n;
+
+  auto skip_to = [&](char close) {
+    const size_t k = pattern.find(close, j);
+    return (k == std::string_view::npos) ? n : k + 1;
+  };
+  if (pattern[j] == '{') return skip_to('}');                     // \x{..} \p{..} \g{..} \o{..} \N{..}
+  if ((e == 'k') || (e == 'g')) {                                 // \k<name> \g<name> \k'name'
+    if (pattern[j] == '<') return skip_to('>');
+    if (pattern[j] == '\'') return skip_to('\'');
+  }
+  if ((e == 'p') || (e == 'P') || (e == 'c')) return j + 1;       // \pL \cX
+  if (e == 'x') {
+    while ((j < n) && (j < i + 4) && std::isxdigit(static_cast<unsigned char>(pattern[j]))) ++j;
+    return j;
+  }
+  if (std::isdigit(static_cast<unsigned char>(e))) {
+    while ((j < n) && std::isdigit(static_cast<unsigned char>(pattern[j]))) ++j;
+  }
+  return j;
+}
+
+// Minimum repeat count and length of a quantifier starting at `i`, a length
+// of 0 means there is none. A '{' that does not form a quantifier is literal.
+static std::pair<size_t, size_t> ParseQuantifier(std::string_view pattern, size_t i) {
+  const size_t n = pattern.size();
+  if (i >= n) return {1, 0};
+
+  size_t min{0};
+  size_t j = i + 1;
+  switch (pattern[i]) {
+    case '*':
+    case '?':
+      break;
+    case '+':
+      min = 1;
+      break;
+    case '{': {
+      size_t digits = 0;
+      while ((j < n) && std::isdigit(static_cast<unsigned char>(pattern[j]))) {
+        min = min * 10 + (pattern[j] - '0');
+        ++j;
+        ++digits;
+      }
+      const bool comma = (j < n) && (pattern[j] == ',');
+      if (comma) {
+        ++j;
+        while ((j < n) && std::isdigit(static_cast<unsigned char>(pattern[j]))) ++j;
+      }
+      if ((j >= n) || (pattern[j] != '}') || ((digits == 0) && !comma)) return {1, 0};
+      ++j;
+      break;
+    }
+    default:
+      return {1, 0};
+  }
+  // lazy or possessive suffix
+  if ((j < n) && ((pattern[j] == '?') || (pattern[j] == '+'))) ++j;
+  return {min, j - i};
+}
+
+std::string RequiredLiteral(std::string_view pattern) {
+  // inline options such as (?i) or (?x) change how everything after them reads
+  for (size_t at = pattern.find("(?"); at != std::string_view::npos; at = pattern.find("(?", at + 2)) {
+    const char next = (at + 2 < pattern.size()) ? pattern[at + 2] : '\0';
+    if (std::islower(static_cast<unsigned char>(next)) || (next == 'J') || (next == 'U') ||
+        (next == '^') || (next == '-')) {
+      return {};
+    }
+  }
+
+  std::string best;
+  std::string run;
+  auto end_run = [&]() {
+    if (run.size() > best.size()) best = run;
+    run.clear();
+  };
+  // start of the last character in `run`, UTF-8 sequences are one character
+  auto last_char = [&run]() {
+    size_t k = run.size() - 1;
+    while ((k > 0) && ((static_cast<unsigned char>(run[k]) & 0xC0) == 0x80)) --k;
+    return k;
+  };
+
+  const size_t n = pattern.size();
+  size_t i = 0;
+  size_t depth = 0;
+  while (i < n) {
+    const char c = pattern[i];
+    if (depth > 0) {
+      // groups may be optional or alternate, nothing inside them counts
+      if ((c == '\\') && (i + 1 < n) && (pattern[i + 1] == 'Q')) {
+        const size_t e = pattern.find("\\E", i + 2);
+        i = (e == std::string_view::npos) ? n : e + 2;
+      } else if (c == '\\') {
+        i += 2;
+      } else if (c == '[') {
+        i = SkipClass(pattern, i);
+      } else if (c == '(') {
+        ++depth;
+        ++i;
+      } else if (c == ')') {
+        --depth;
+        ++i;
+        // skip a quantifier on the group so it is not read as literal text
+        if (depth == 0) i += ParseQuantifier(pattern, i).second;
+      } else {
+        ++i;
+      }
+      continue;
+    }
+
+    bool literal = false;
+    switch (c) {
+      case '|':
+        return {};
+      case ')':
+        return {};
+      case '(':
+        end_run();
+        depth = 1;
+        ++i;
+        continue;
+      case '[':
+        end_run();
+        i = SkipClass(pattern, i);
+        break;
+      case '\\': {
+        const char e = (i + 1 < n) ? pattern[i + 1] : '\0';
+        if (e == 'Q') {
+          const size_t close = pattern.find("\\E", i + 2);
+          const size_t stop = (close == std::string_view::npos) ? n : close;
+          run.append(pattern.substr(i + 2, stop - i - 2));
+          literal = stop > i + 2;
+          i = (close == std::string_view::npos) ? n : close + 2;
+        } else if ((e != '\0') && !std::isalnum(static_cast<unsigned char>(e))) {
+          run.push_back(e); // escaped punctuation
+          literal = true;
+          i += 2;
+        } else {
+          end_run();
+          i = SkipEscape(pattern, i);
+        }
+        break;
+      }
+      case '.':
+      case '^':
+      case '$':
+      case '*':
+      case '+':
+      case '?':
+        end_run();
+        ++i;
+        break;
+      default: {
+        size_t len = 1;
+        if (static_cast<unsigned char>(c) >= 0xC0) {
+          while ((i + len < n) && ((static_cast<unsigned char>(pattern[i + len]) & 0xC0) == 0x80)) ++len;
+        }
+        run.append(pattern.substr(i, len));
+        literal = true;
+        i += len;
+        break;
+      }
+    }
+
+    const auto [min, length] = ParseQuantifier(pattern, i);
+    if (length == 0) continue;
+    // an optional character leaves the run, a repeated one still ends it
+    if (literal && (min == 0)) run.resize(last_char());
+    end_run();
+    i += length;
+  }
+  end_run();
+  if (best.size() < kMinLiteralLength) best.clear();
+  return best;
+}
+
+// Running a pattern over a buffer of many lines finds the same lines as
+// running it per line as long as it cannot look past the line it matched in.
+// Assertions on the subject's ends, lookarounds and \K (which moves the
+// reported start) can, patterns that match the empty string would hit every
+// line. Text inspection is deliberately conservative, a false negative only
+// costs the faster search mode.
+static bool StaysWithinLine(std::string_view pattern) {
+  for (std::string_view token : {"\\A", "\\z", "\\Z", "\\G", "\\K", "(?=", "(?!", "(?<=", "(?<!", "(*"}) {
+    if (pattern.find(token) != std::string_view::npos) return false;
+  }
+  return true;
+}
+
+static bool MatchesEmpty(const pcre2_code* code) {
+  uint32_t match_empty{1};
+  pcre2_pattern_info(code, PCRE2_INFO_MATCHEMPTY, &match_empty);
+  return match_empty != 0;
+}
+
+static bool IsBufferSearchable(std::string_view pattern, const pcre2_code* code) {
+  return StaysWithinLine(pattern) && !MatchesEmpty(code);
+}
+
+static uint32_t CompileOptions(bool enable_utf, std::optional<InvalidUtf8> invalid_utf8) {
+  // Subjects are single lines, so multiline never changes a per line result.
+  // It makes ^ and $ match at line boundaries when running over a buffer.
+  uint32_t compile_options = PCRE2_MULTILINE;
+  if (enable_utf) compile_options |= PCRE2_UTF | PCRE2_UCP; // enable UTF-8 and Unicode property support
+  if (enable_utf && (invalid_utf8 == InvalidUtf8::kBytes)) compile_options |= PCRE2_MATCH_INVALID_UTF;
+  return compile_options;
+}
+
+static pcre2_code* CompileCode(std::string_view pattern, uint32_t compile_options) {
   int errornumber{0};
   PCRE2_SIZE erroroffset{0};
+  pcre2_code* code = pcre2_compile(reinterpret_cast<PCRE2_SPTR>(pattern.data()),
+                                   pattern.size(), compile_options, &errornumber, &erroroffset, nullptr);
+  if (!code) {
+    std::string msg(256, '.');
+    pcre2_get_error_message(errornumber, reinterpret_cast<PCRE2_UCHAR*>(&msg[1]), msg.size()-1);
+    std::string_view error_msg = common::FormatIntoStringView<"PCRE2 compilation failed on pattern.\nPattern: %s\nError Offset: %d\nError: %s\n">(
+                                                              pattern, erroroffset, msg);
+    throw std::runtime_error(std::string(error_msg));
+  }
+  return code;
+}
 
-  uint32_t compile_options = 0;
-  if (enable_utf) compile_options = PCRE2_UTF | PCRE2_UCP; // enable UTF-8 and Unicode property support
+// The interpreter re-validates UTF from the start offset to the end of the
+// subject on every call, which is quadratic over a buffer, unless subjects
+// were validated up front.
+static bool AffordsBufferSearch(const Pcre2Compiled& compiled, bool enable_utf) {
+  return compiled.jitted || !enable_utf || SubjectsValidated(compiled);
+}
 
-  Pcre2Compiled compiled{pcre2_compile(reinterpret_cast<PCRE2_SPTR>(pattern.data()),
-                                       pattern.size(), compile_options, &errornumber, &erroroffset, nullptr),
-                         false /* jitted */};
-  if (compiled.p && jit_compile) {
+// Takes over `code` compiled from `pattern` and prepares it for matching.
+static Pcre2Compiled Finish(pcre2_code* code, std::string_view pattern, bool jit_compile, bool enable_utf,
+                            std::optional<InvalidUtf8> invalid_utf8) {
+  Pcre2Compiled compiled{code, false /* jitted */};
+  if (enable_utf) {
+    compiled.invalid_utf8 = invalid_utf8;
+    const bool validated = (invalid_utf8 == InvalidUtf8::kReplace) || (invalid_utf8 == InvalidUtf8::kSkip);
+    compiled.match_options = validated ? PCRE2_NO_UTF_CHECK : 0;
+  }
+  if (jit_compile) {
     int jit_errorcode = pcre2_jit_compile(compiled.p, PCRE2_JIT_COMPLETE);
     if (jit_errorcode != 0) {
       std::string error;
@@ -72,38 +420,253 @@ Pcre2Compiled Compile(std::string_view pattern, bool jit_compile, bool enable_ut
     }
     compiled.jitted = true;
   }
-  if (!compiled.p) {
-    std::string msg(256, '.');
-    pcre2_get_error_message(errornumber, reinterpret_cast<PCRE2_UCHAR*>(&msg[1]), msg.size()-1);
-    std::string_view error_msg = common::FormatIntoStringView<"PCRE2 compilation failed on pattern.\nPattern: %s\nError Offset: %d\nError: %s\n">(
-                                                              pattern, erroroffset, msg);
-    throw std::runtime_error(std::string(error_msg));
-  }
+  compiled.buffer_searchable = IsBufferSearchable(pattern, compiled.p) && AffordsBufferSearch(compiled, enable_utf);
+  compiled.pattern = pattern;
+  compiled.literal = RequiredLiteral(pattern);
   return compiled;
 }
 
+// Compile() without the pattern cache.
+static Pcre2Compiled CompileUncached(std::string_view pattern, bool jit_compile, bool enable_utf,
+                                     std::optional<InvalidUtf8> invalid_utf8) {
+  return Finish(CompileCode(pattern, CompileOptions(enable_utf, invalid_utf8)), pattern, jit_compile, enable_utf,
+                invalid_utf8);
+}
+
+Pcre2Compiled Compile(std::string_view pattern, bool jit_compile, bool enable_utf,
+                      std::optional<InvalidUtf8> invalid_utf8) {
+  const uint32_t compile_options = CompileOptions(enable_utf, invalid_utf8);
+  const std::string key = "pattern:"s.append(pattern);
+  std::vector<CachedPattern> cached = LoadCachedPatterns(key, compile_options);
+  if (cached.size() == 1) return Finish(cached[0].code, pattern, jit_compile, enable_utf, invalid_utf8);
+  for (CachedPattern& c : cached) pcre2_code_free(c.code);
+
+  pcre2_code* code = CompileCode(pattern, compile_options);
+  StoreCachedPatterns(key, compile_options, {CachedPattern{0, std::string{pattern}, code}});
+  return Finish(code, pattern, jit_compile, enable_utf, invalid_utf8);
+}
+
+// Below this many patterns the literal prefilters and buffer search of
+// standalone patterns beat one combined program.
+constexpr size_t kMinCombinedPatterns = 4;
+// Upper bound of patterns per combined program, larger sets are split. PCRE2
+// limits the size of a compiled pattern, a program that is still too large
+// is halved until it compiles.
+constexpr size_t kMaxCombinedPatterns = 256;
+
+// Patterns that name groups, call groups by number or recurse, use relative
+// back references or verbs would change meaning inside a combined program,
+// and so would inline extended mode: a # comment would run on over the text
+// that closes the member.
+static bool IsCombinable(std::string_view pattern) {
+  for (std::string_view token : {"(?P", "(?'", "(?R", "(?&", "(?(R", "\\k", "\\g", "(*"}) {
+    if (pattern.find(token) != std::string_view::npos) return false;
+  }
+  for (size_t at = pattern.find("(?"); at != std::string_view::npos; at = pattern.find("(?", at + 2)) {
+    const std::string_view next = pattern.substr(at + 2, 2);
+    if (next.empty()) continue;
+    // named group, lookbehinds are fine
+    if ((next[0] == '<') && ((next.size() < 2) || ((next[1] != '=') && (next[1] != '!')))) return false;
+    // (?1) (?+1) (?-1)
+    const size_t digit = ((next[0] == '+') || (next[0] == '-')) ? 1 : 0;
+    if ((digit < next.size()) && std::isdigit(static_cast<unsigned char>(next[digit]))) return false;
+    // (?x) (?ix-s) (?^x:...), unsetting x is refused as well
+    size_t end = at + 2;
+    while ((end < pattern.size()) && (std::isalpha(static_cast<unsigned char>(pattern[end])) ||
+                                      (pattern[end] == '-') || (pattern[end] == '^'))) {
+      ++end;
+    }
+    const std::string_view options = pattern.substr(at + 2, end - at - 2);
+    if ((end < pattern.size()) && ((pattern[end] == ')') || (pattern[end] == ':')) &&
+        (options.find('x') != std::string_view::npos)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Compiles patterns[indexes[begin..end)] into combined programs. A pattern
+// that compiles on its own but not inside a program is added to `standalone`
+// instead, errors are only ever about a user's pattern.
+static void AddCombined(Pcre2PatternSet& set, const std::vector<std::string_view>& patterns,
+                        const std::vector<size_t>& indexes, size_t begin, size_t end,
+                        bool within_line, bool jit_compile, bool enable_utf,
+                        std::optional<InvalidUtf8> invalid_utf8, std::vector<size_t>& standalone) {
+  std::string text = "(?|";
+  for (size_t k = begin; k < end; ++k) {
+    if (k != begin) text.push_back('|');
+    // a stray \E is ignored, after a member it closes an unterminated \Q
+    text.append("(?:").append(patterns[indexes[k]]).append("\\E)(*MARK:");
+    text.append(std::to_string(indexes[k])).push_back(')');
+  }
+  text.push_back(')');
+
+  try {
+    set.matchers.emplace_back(Regex(CompileUncached(text, jit_compile, enable_utf, invalid_utf8)));
+    set.ids.push_back(Pcre2PatternSet::kCombined);
+  } catch (const std::runtime_error&) {
+    if (end - begin == 1) {
+      standalone.push_back(indexes[begin]);
+      return;
+    }
+    const size_t mid = begin + (end - begin) / 2;
+    AddCombined(set, patterns, indexes, begin, mid, within_line, jit_compile, enable_utf, invalid_utf8, standalone);
+    AddCombined(set, patterns, indexes, mid, end, within_line, jit_compile, enable_utf, invalid_utf8, standalone);
+    return;
+  }
+  // the marks defeat the text check, the members were checked instead. The
+  // alternation matches empty exactly when one of its members does.
+  Pcre2Compiled& compiled = set.matchers.back().re;
+  compiled.buffer_searchable = within_line && !MatchesEmpty(compiled.p) && AffordsBufferSearch(compiled, enable_utf);
+}
+
+// Cache key of a whole set, the patterns with their lengths.
+static std::string SetKey(const std::vector<std::string_view>& patterns) {
+  std::string key = "set:";
+  for (std::string_view p : patterns) key.append(std::to_string(p.size())).append(":").append(p);
+  return key;
+}
+
+Pcre2PatternSet CompileSet(const std::vector<std::string_view>& patterns, bool jit_compile, bool enable_utf,
+                           std::optional<InvalidUtf8> invalid_utf8) {
+  Pcre2PatternSet set;
+  set.size = patterns.size();
+  set.patterns.assign(patterns.begin(), patterns.end());
+
+  std::vector<size_t> combined;
+  std::vector<size_t> standalone;
+  for (size_t i = 0; i < patterns.size(); ++i) {
+    (IsCombinable(patterns[i]) ? combined : standalone).push_back(i);
+  }
+  if (combined.size() < kMinCombinedPatterns) {
+    standalone.insert(standalone.end(), combined.begin(), combined.end());
+    combined.clear();
+  }
+  const bool within_line = std::all_of(combined.begin(), combined.end(), [&patterns](size_t i) {
+    return StaysWithinLine(patterns[i]);
+  });
+
+  // a cached set was validated before it was stored, only the JIT step remains
+  const uint32_t compile_options = CompileOptions(enable_utf, invalid_utf8);
+  const std::string key = SetKey(patterns);
+  std::vector<CachedPattern> cached = LoadCachedPatterns(key, compile_options);
+  if (!cached.empty()) {
+    try {
+      for (CachedPattern& c : cached) {
+        set.matchers.emplace_back(
+          Regex(Finish(std::exchange(c.code, nullptr), c.pattern, jit_compile, enable_utf, invalid_utf8)));
+        set.ids.push_back(c.id);
+        if (c.id == Pcre2PatternSet::kCombined) {
+          Pcre2Compiled& compiled = set.matchers.back().re;
+          compiled.buffer_searchable = within_line && !MatchesEmpty(compiled.p) &&
+                                       AffordsBufferSearch(compiled, enable_utf);
+        }
+      }
+    } catch (...) {
+      for (CachedPattern& c : cached) pcre2_code_free(c.code);
+      throw;
+    }
+    return set;
+  }
+
+  // Validate members on their own first: errors point at the right pattern and
+  // an unbalanced pattern cannot leak out of its group. Without JIT this is cheap.
+  for (size_t i : combined) {
+    pcre2_code_free(CompileCode(patterns[i], compile_options));
+  }
+  for (size_t begin = 0; begin < combined.size(); begin += kMaxCombinedPatterns) {
+    const size_t end = std::min(begin + kMaxCombinedPatterns, combined.size());
+    AddCombined(set, patterns, combined, begin, end, within_line, jit_compile, enable_utf, invalid_utf8, standalone);
+  }
+  std::sort(standalone.begin(), standalone.end());
+  for (size_t i : standalone) {
+    set.matchers.emplace_back(Regex(CompileUncached(patterns[i], jit_compile, enable_utf, invalid_utf8)));
+    set.ids.push_back(i);
+  }
+
+  std::vector<CachedPattern> entry;
+  for (size_t k = 0; k < set.matchers.size(); ++k) {
+    entry.push_back(CachedPattern{set.ids[k], set.matchers[k].re.pattern, set.matchers[k].re.p});
+  }
+  StoreCachedPatterns(key, compile_options, entry);
+  return set;
+}
+
 Pcre2Regex Regex(Pcre2Compiled&& pattern) {
-  Pcre2Regex out(std::move(pattern), nullptr);
-  out.match_data = pcre2_match_data_create_from_pattern(out.re.p, nullptr);
-  return out;
+  return Pcre2Regex(std::move(pattern));
 }
 
 bool Find(const Pcre2Regex& search_pattern, std::string_view content) {
   if (!search_pattern.re.p) return false;
+  PatternSample sample(search_pattern.re);
+  if (!search_pattern.re.literal.empty() &&
+      (FindLiteral(content, search_pattern.re.literal) == std::string_view::npos)) {
+    return false;
+  }
+
+  pcre2_match_data* match_data = MatchData(search_pattern);
+  int retcode{0};
+  if (!search_pattern.re.jitted) {
+    retcode = pcre2_match(search_pattern.re.p,
+                          reinterpret_cast<PCRE2_SPTR>(content.data()),
+                          content.size(), 0, search_pattern.re.match_options, match_data,
+                          nullptr);
+  } else {
+    retcode = pcre2_jit_match(search_pattern.re.p,
+                              reinterpret_cast<PCRE2_SPTR>(content.data()),
+                              content.size(), 0, search_pattern.re.match_options, match_data,
+                              thread_local_jit_context.match_context);
+  }
+  return sample.Hit(retcode >= 0);
+}
 
+std::optional<MatchSpan> Search(const Pcre2Regex& search_pattern, std::string_view content, size_t offset) {
+  if (!search_pattern.re.p || offset > content.size()) return std::nullopt;
+  PatternSample sample(search_pattern.re);
+  if (!search_pattern.re.literal.empty() &&
+      (FindLiteral(content.substr(offset), search_pattern.re.literal) == std::string_view::npos)) {
+    return std::nullopt;
+  }
+
+  pcre2_match_data* match_data = MatchData(search_pattern);
   int retcode{0};
   if (!search_pattern.re.jitted) {
     retcode = pcre2_match(search_pattern.re.p,
                           reinterpret_cast<PCRE2_SPTR>(content.data()),
-                          content.size(), 0, 0, search_pattern.match_data,
+                          content.size(), offset, search_pattern.re.match_options, match_data,
                           nullptr);
   } else {
     retcode = pcre2_jit_match(search_pattern.re.p,
                               reinterpret_cast<PCRE2_SPTR>(content.data()),
-                              content.size(), 0, 0, search_pattern.match_data,
-                              thread_local_jit_context.match_context);    
+                              content.size(), offset, search_pattern.re.match_options, match_data,
+                              thread_local_jit_context.match_context);
+  }
+  if (!sample.Hit(retcode >= 0)) return std::nullopt;
+
+  const PCRE2_SIZE* ovector = pcre2_get_ovector_pointer(match_data);
+  // \K can move the reported start past the end, keep the span well formed
+  return MatchSpan{std::min(ovector[0], ovector[1]), ovector[1]};
+}
+
+std::optional<MatchSpan> CapturedGroup(const Pcre2Regex& search_pattern, size_t group) {
+  if (!search_pattern.re.p || (group >= search_pattern.ovector_pairs)) return std::nullopt;
+  const PCRE2_SIZE* ovector = pcre2_get_ovector_pointer(MatchData(search_pattern));
+  if (ovector[2 * group] == PCRE2_UNSET) return std::nullopt;
+  return MatchSpan{std::min(ovector[2 * group], ovector[2 * group + 1]), ovector[2 * group + 1]};
+}
+
+std::optional<size_t> FindAny(const Pcre2PatternSet& set, std::string_view content) {
+  for (size_t k = 0; k < set.matchers.size(); ++k) {
+    if (!Find(set.matchers[k], content)) continue;
+    if (set.ids[k] != Pcre2PatternSet::kCombined) return set.ids[k];
+
+    const char* mark = reinterpret_cast<const char*>(pcre2_get_mark(MatchData(set.matchers[k])));
+    size_t id{0};
+    if (mark) std::from_chars(mark, mark + std::strlen(mark), id);
+    if (!set.stats_ids.empty()) CountHit(set.stats_ids[id]);
+    return id;
   }
-  return retcode >= 0;
+  return std::nullopt;
 }
 
 std::string_view Substitute(const Pcre2Substitution& substitution, std::string_view content,
@@ -111,29 +674,50 @@ std::string_view Substitute(const Pcre2Substitution& substitution, std::string_v
   if (!substitution.re.p) {
     return content;
   }
+  PatternSample sample(substitution.re);
+  if (!substitution.re.literal.empty() &&
+      (FindLiteral(content, substitution.re.literal) == std::string_view::npos)) {
+    return content;
+  }
 
-  PCRE2_SIZE out_length = scratch_buffer.size();
-  int rc = pcre2_substitute(substitution.re.p,
-                            reinterpret_cast<PCRE2_SPTR>(content.data()),
-                            content.size(),
-                            0,
-                            0,
-                            nullptr,
-                            nullptr,
-                            reinterpret_cast<PCRE2_SPTR>(substitution.substitute_pattern.data()),
-                            substitution.substitute_pattern.size(),
-                            reinterpret_cast<PCRE2_UCHAR*>(scratch_buffer.data()),
-                            &out_length);
-  if (rc == 0) return content;
-
-  if ((rc > 0) && out_length <= scratch_buffer.size()) {
-    return {scratch_buffer.data(), out_length};
-  } else {
-    std::string_view error_msg = common::FormatIntoStringView<"Substitution requires more memory: needed %?, scratch size %zu\n">(
-                                                              out_length, scratch_buffer.size());
-    throw std::runtime_error(std::string(error_msg));
+  // a scratch buffer that is too small reports the required length instead,
+  // so at most one retry is needed
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    PCRE2_SIZE out_length = scratch_buffer.size();
+    const int rc = pcre2_substitute(substitution.re.p,
+                                    reinterpret_cast<PCRE2_SPTR>(content.data()),
+                                    content.size(),
+                                    0,
+                                    PCRE2_SUBSTITUTE_OVERFLOW_LENGTH | substitution.re.match_options,
+                                    nullptr,
+                                    nullptr,
+                                    reinterpret_cast<PCRE2_SPTR>(substitution.substitute_pattern.data()),
+                                    substitution.substitute_pattern.size(),
+                                    reinterpret_cast<PCRE2_UCHAR*>(scratch_buffer.data()),
+                                    &out_length);
+    if (rc == 0) return content;
+    if (rc > 0) {
+      sample.Hit(true);
+      return {scratch_buffer.data(), out_length};
+    }
+    if (rc != PCRE2_ERROR_NOMEMORY) {
+      std::string_view error_msg = common::FormatIntoStringView<"Substitution failed with error code %d\n">(rc);
+      throw std::runtime_error(std::string(error_msg));
+    }
+    scratch_buffer.resize(std::max<size_t>(out_length, 2 * scratch_buffer.size()));
+  }
+  throw std::runtime_error("Substitution requires more memory than reported\n");
+}
+
+std::string_view SubstituteAll(const std::vector<Pcre2Substitution>& substitutions, std::string_view content,
+                               std::array<std::string, 2>& scratch_buffers) {
+  size_t next = 0;
+  for (const Pcre2Substitution& substitution : substitutions) {
+    const std::string_view result = Substitute(substitution, content, scratch_buffers[next]);
+    if (result.data() != scratch_buffers[next].data()) continue;  // no match, nothing was written
+    content = result;
+    next ^= 1;
   }
-  // no substitution performed
   return content;
 }
  
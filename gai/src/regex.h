@@ -3,20 +3,63 @@
 
 #include <pcre2.h>
 
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <vector>
 
 namespace gai {
 
+// What --utf does with subjects that are not valid UTF-8, a policy of each
+// UTF pattern, fixed when it is compiled. With kReplace and kSkip every
+// subject is checked once, a buffer at a time, by ValidateUtf8() in
+// Process(), ProcessBuffer() and Pipeline, which also apply the policy, and
+// match calls pass PCRE2_NO_UTF_CHECK instead of having PCRE2 check every
+// subject again; subjects handed to the match functions directly must then
+// be valid. kBytes compiles with PCRE2_MATCH_INVALID_UTF and needs no checks.
+// Without a policy PCRE2 checks subjects itself, except for JIT matches,
+// which take valid UTF-8 only.
+enum class InvalidUtf8 {
+  kReplace,  // bytes that do not start a valid sequence become U+FFFD
+  kSkip,     // lines holding such bytes are never matched
+  kBytes,    // kept as they are: they never match, the text around them does
+};
+
 struct Pcre2Compiled {
+  static constexpr size_t kNotTracked = static_cast<size_t>(-1);
+
   pcre2_code* p{nullptr};
   bool jitted{false};
+  // Whether the pattern can be run over a whole buffer of lines instead of
+  // one line at a time, see Compile().
+  bool buffer_searchable{false};
+  // Source text of the pattern.
+  std::string pattern;
+  // Text every match has to contain (see RequiredLiteral), checked with a
+  // plain substring search before PCRE2 is called. Empty if there is none.
+  std::string literal;
+  // Policy for invalid UTF-8 in subjects, nullopt for byte patterns and UTF
+  // patterns without one.
+  std::optional<InvalidUtf8> invalid_utf8;
+  // Options every match call passes, PCRE2_NO_UTF_CHECK when subjects are
+  // validated before they are matched.
+  uint32_t match_options{0};
+  // Slot of the pattern's --stats counters, set by TrackPattern() once the
+  // pattern is compiled; kNotTracked when statistics are off.
+  mutable size_t stats_id{kNotTracked};
 
   Pcre2Compiled() = delete;
   Pcre2Compiled(pcre2_code* p_, bool jitted_);
-  Pcre2Compiled(Pcre2Compiled&& other) noexcept : p(other.p), jitted(other.jitted) {
+  Pcre2Compiled(Pcre2Compiled&& other) noexcept
+      : p(other.p), jitted(other.jitted), buffer_searchable(other.buffer_searchable),
+        pattern(std::move(other.pattern)), literal(std::move(other.literal)), invalid_utf8(other.invalid_utf8),
+        match_options(other.match_options), stats_id(other.stats_id) {
     other.p = nullptr;
     other.jitted = false;
+    other.buffer_searchable = false;
   }
 
   Pcre2Compiled& operator=(Pcre2Compiled&& other) noexcept {
@@ -24,8 +67,15 @@ struct Pcre2Compiled {
       if (p) pcre2_code_free(p);
       p = other.p;
       jitted = other.jitted;
+      buffer_searchable = other.buffer_searchable;
+      pattern = std::move(other.pattern);
+      literal = std::move(other.literal);
+      invalid_utf8 = other.invalid_utf8;
+      match_options = other.match_options;
+      stats_id = other.stats_id;
       other.p = nullptr;
       other.jitted = false;
+      other.buffer_searchable = false;
     }
     return *this;
   }
@@ -34,33 +84,34 @@ struct Pcre2Compiled {
   ~Pcre2Compiled();
 };
 
+// A compiled pattern that can be matched from any number of threads. The
+// code is never modified after compilation; match data lives in a per-thread
+// cache indexed by `id`, which is unique among live patterns and reused once
+// a pattern is destroyed.
 struct Pcre2Regex {
+  static constexpr size_t kNoId = static_cast<size_t>(-1);
+
   Pcre2Compiled re;
-  pcre2_match_data* match_data{nullptr};
+  size_t id{kNoId};
+  // ovector pairs a match needs, captures plus the whole match
+  uint32_t ovector_pairs{1};
 
   Pcre2Regex() = delete;
-  Pcre2Regex(Pcre2Compiled&& re_, pcre2_match_data* m);
+  explicit Pcre2Regex(Pcre2Compiled&& re_);
 
   Pcre2Regex(Pcre2Regex&& other) noexcept
-      : re(std::move(other.re)),
-        match_data(other.match_data) {
-    other.match_data = nullptr;
+      : re(std::move(other.re)), id(other.id), ovector_pairs(other.ovector_pairs) {
+    other.id = kNoId;
   }
 
-  Pcre2Regex& operator=(Pcre2Regex&& other) noexcept {
-    if (this != &other) {
-      re = std::move(other.re);
-      if (match_data) pcre2_match_data_free(match_data);
-      match_data = other.match_data;
-      other.match_data = nullptr;
-    }
-    return *this;
-  }
+  Pcre2Regex& operator=(Pcre2Regex&& other) noexcept;
   Pcre2Regex(const Pcre2Regex&) = delete;
   Pcre2Regex& operator=(const Pcre2Regex&) = delete;
   ~Pcre2Regex();
 };
 
+using SharedRegex = std::shared_ptr<const Pcre2Regex>;
+
 struct Pcre2Substitution {
   Pcre2Compiled re;
   std::string substitute_pattern;
@@ -74,12 +125,76 @@ struct Pcre2Substitution {
   ~Pcre2Substitution() = default;
 };
 
-Pcre2Compiled Compile(std::string_view pattern, bool jit_compile, bool enable_utf);
+// A list of patterns evaluated as one. When there are enough of them, the
+// patterns that can be embedded safely are merged into combined programs of
+// the form (?|(?:p0)(*MARK:0)|(?:p1)(*MARK:1)|...): one PCRE2 call tests all
+// of them and the mark of a match names the pattern that hit. Branch reset
+// keeps each pattern's own group numbering. Everything else stays standalone.
+struct Pcre2PatternSet {
+  // id of a matcher that is a combined program
+  static constexpr size_t kCombined = static_cast<size_t>(-1);
+
+  // combined programs first, then standalone patterns in input order
+  std::vector<Pcre2Regex> matchers;
+  // input index of each standalone matcher, kCombined for combined programs
+  std::vector<size_t> ids;
+  // number of input patterns
+  size_t size{0};
+  // the input patterns as given
+  std::vector<std::string> patterns;
+  // --stats id of each input pattern, empty until the set is tracked (see
+  // TrackPatternSet); hits inside a combined program are counted through it
+  mutable std::vector<size_t> stats_ids;
+
+  bool empty() const { return size == 0; }
+};
+
+// Byte offsets of a match, `end` is one past the last matched byte.
+struct MatchSpan {
+  size_t start{0};
+  size_t end{0};
+};
+
+// Longest run of literal text that every match of `pattern` has to contain,
+// empty if none can be proven. Only the top level sequence is considered:
+// groups, classes and non literal escapes end a run, optional characters
+// drop out of it and any top level alternation or inline option gives up.
+std::string RequiredLiteral(std::string_view pattern);
+
+// True when subjects of `re` are validated before they are matched (kReplace,
+// kSkip), so the match calls skip PCRE2's own check.
+inline bool SubjectsValidated(const Pcre2Compiled& re) { return (re.match_options & PCRE2_NO_UTF_CHECK) != 0; }
+
+// `invalid_utf8` is the policy of a UTF pattern (see InvalidUtf8), ignored
+// without `enable_utf`.
+Pcre2Compiled Compile(std::string_view pattern, bool jit_compile, bool enable_utf,
+                      std::optional<InvalidUtf8> invalid_utf8 = std::nullopt);
 Pcre2Regex Regex(Pcre2Compiled&& pattern);
+Pcre2PatternSet CompileSet(const std::vector<std::string_view>& patterns, bool jit_compile, bool enable_utf,
+                           std::optional<InvalidUtf8> invalid_utf8 = std::nullopt);
 
 bool Find(const Pcre2Regex& search_pattern, std::string_view content);
+// Leftmost match in `content` starting at or after `offset`. Characters in
+// front of `offset` are still visible to lookbehinds and \b.
+std::optional<MatchSpan> Search(const Pcre2Regex& search_pattern, std::string_view content, size_t offset = 0);
+// Span of capture `group` (0 for the whole match) of the last successful
+// Search() or Find() of `search_pattern` on the calling thread, read from the
+// ovector that call filled. Empty for groups that did not take part in the
+// match or that the pattern does not have.
+std::optional<MatchSpan> CapturedGroup(const Pcre2Regex& search_pattern, size_t group);
+// Input index of a pattern of `set` that matches `content`.
+std::optional<size_t> FindAny(const Pcre2PatternSet& set, std::string_view content);
+// Replaces the first match of `substitution` in `content`. The result is
+// written to `scratch_buffer`, which grows when it is too small; `content` is
+// returned as is when nothing matched. `content` must not point into
+// `scratch_buffer`.
 std::string_view Substitute(const Pcre2Substitution& substitution, std::string_view content,
                             std::string& scratch_buffer);
+// Applies `substitutions` one after the other. Results alternate between the
+// two scratch buffers, so nothing is copied between steps and nothing at all
+// when no substitution matched.
+std::string_view SubstituteAll(const std::vector<Pcre2Substitution>& substitutions, std::string_view content,
+                               std::array<std::string, 2>& scratch_buffers);
 }  // namespace gai
 
 #endif  // REGEX_H_
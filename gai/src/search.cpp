@@ -0,0 +1,266 @@
+#include "search.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <utility>
+
+#include "batch_read.h"
+#include "decompress.h"
+#include "input.h"
+#include "line_index.h"
+#include "parallel.h"
+#include "simd.h"
+#include "stats.h"
+#include "printx.hpp"
+
+namespace gai {
+
+// Files of at least twice this size are split into newline aligned chunks
+// that are scanned by several workers.
+constexpr size_t kMinChunkSize = 16 << 20;
+
+// Shared by all tasks working on the chunks of one file.
+struct ChunkedFile {
+  std::string path;
+  common::LoadedFile contents;
+  std::vector<std::string_view> chunks;
+  std::vector<size_t> first_linenum;
+  // lines in front of the first chunk that the range cannot reach
+  size_t skipped_lines{0};
+  std::atomic<size_t> remaining{0};
+};
+
+void ProcessFileContents(const Patterns& p, OutputSink& sink, std::optional<Range>& range, const std::string& path,
+                         std::string_view contents) {
+  try {
+    ProcessContents(p.filters, p.excludes, p.replacements, sink, range, contents);
+  } catch (const DecompressError& ex) {
+    rostd::fprintf<"gai: %s: %s\n">(stderr, path, ex.what());
+  }
+}
+
+static OrderedWriter::Slot Child(const OrderedWriter::Slot& slot, size_t index) {
+  OrderedWriter::Slot child = slot;
+  child.push_back(index);
+  return child;
+}
+
+// Input i owns output slot {i}. A directory splits its slot into one slot per
+// entry once it has been listed and a file cut into chunks into one per
+// chunk, so the order of the output does not depend on which task finishes
+// first.
+void ProcessFilesParallel(const std::vector<std::string_view>& inputs, const WalkOptions& walk_options,
+                          size_t threads, bool use_io_uring, const common::LoadOptions& load_options,
+                          const Patterns& p, const OutputOptions& output, FILE* stream) {
+  using Slot = OrderedWriter::Slot;
+  WorkStealingPool pool(threads);
+  // the compiled patterns are shared, every worker tracks its own range state
+  std::vector<std::optional<Range>> worker_ranges(pool.Size(), p.range);
+  std::vector<std::string> worker_buffers(pool.Size());
+  std::vector<std::unique_ptr<BatchReader>> worker_readers(pool.Size());
+  OrderedWriter writer(stream);
+
+  auto process_chunk = [&](const std::shared_ptr<ChunkedFile>& file, const Slot& slot, size_t worker) {
+    std::optional<Range>& range = worker_ranges[worker];
+    std::string& buffer = worker_buffers[worker];
+    const size_t k = slot.back();
+    try {
+      if (range) range->Seek(file->first_linenum[k]);
+      OutputSink sink(buffer, output.verbose, output.delimiter);
+      output.Configure(sink);
+      sink.SetFilename(file->path);
+      ProcessBuffer(p.filters, p.excludes, p.replacements, sink, range, file->chunks[k], file->first_linenum[k]);
+    } catch (...) {
+      // a failed chunk still completes its slot, everything after it would
+      // stay parked otherwise
+      writer.Complete(slot, buffer);
+      throw;
+    }
+    writer.Complete(slot, buffer);
+  };
+
+  // a chunk's first line number is only known once every chunk before it has
+  // been counted, so the last counting task turns the counts into prefix sums
+  // and schedules the scan
+  auto count_chunk = [&](const std::shared_ptr<ChunkedFile>& file, const Slot& slot, size_t k) {
+    file->first_linenum[k] = CountNewlines(file->chunks[k]);
+    if (file->remaining.fetch_sub(1) != 1) return;
+
+    size_t total = file->skipped_lines;
+    for (size_t& n : file->first_linenum) total += std::exchange(n, total);
+    for (size_t c = 0; c < file->chunks.size(); ++c) {
+      pool.Submit([&, file, chunk = Child(slot, c)](size_t worker) { process_chunk(file, chunk, worker); });
+    }
+  };
+
+  auto process_file = [&](const Slot& slot, const std::string& path, size_t worker) {
+    // until the file is handed to its chunks a failure completes its slot,
+    // with what was printed, so the files after it are still written in order
+    bool handed_over = false;
+    try {
+      std::optional<Range>& range = worker_ranges[worker];
+      auto file = std::make_shared<ChunkedFile>();
+      file->path = path;
+      std::error_code ec;
+      {
+        StageTimer timer(Stage::kInput);
+        file->contents = common::LoadFile(file->path, load_options, ec);
+      }
+      const bool compressed = DetectCompression(file->contents.View()) != Compression::kNone;
+      std::optional<LineIndex> index;
+      if (!compressed) {
+        StageTimer timer(Stage::kInput);
+        index = GetLineIndex(file->path, file->contents.View());
+      }
+      // only the lines a numeric range can reach are split and scanned
+      if (range) range->Reset();
+      const RangeSlice slice = compressed ? RangeSlice{file->contents.View(), 0}
+                                          : SliceToRange(range, file->contents.View(), 0, index ? &*index : nullptr);
+      const size_t size = slice.buffer.size();
+
+      // a regex bound makes the range state depend on every line before, such
+      // files are scanned by a single worker, and so are compressed ones
+      const bool split = (size >= 2 * kMinChunkSize) && (!range || range->IsLineBased()) &&
+                         !output.NeedsWholeFile() && !compressed;
+      if (!split) {
+        std::string& buffer = worker_buffers[worker];
+        if (!ec) {
+          OutputSink sink(buffer, output.verbose, output.delimiter);
+          output.Configure(sink);
+          sink.SetFilename(file->path);
+          if (compressed) {
+            ProcessFileContents(p, sink, range, file->path, file->contents.View());
+          } else {
+            ProcessBuffer(p.filters, p.excludes, p.replacements, sink, range, slice.buffer, slice.linenum);
+          }
+          sink.EndFile();
+        }
+        // unreadable files still complete their slot so later files are not held back
+        handed_over = true;
+        writer.Complete(slot, buffer);
+        return;
+      }
+
+      const size_t chunk_size = std::max(kMinChunkSize, size / (4 * pool.Size()));
+      // indexed files are split at index entries, whose line numbers are known
+      if (index) {
+        index->Split(file->contents.View(), slice.buffer, slice.linenum, chunk_size, file->chunks,
+                     file->first_linenum);
+        handed_over = true;
+        writer.Split(slot, file->chunks.size());
+        for (size_t c = 0; c < file->chunks.size(); ++c) {
+          pool.Submit([&, file, chunk = Child(slot, c)](size_t w) { process_chunk(file, chunk, w); });
+        }
+        return;
+      }
+      file->chunks = SplitIntoChunks(slice.buffer, chunk_size);
+      file->first_linenum.assign(file->chunks.size(), 0);
+      file->skipped_lines = slice.linenum;
+      const bool needs_linenum = output.verbose || p.range.has_value();
+      file->remaining = file->chunks.size();
+      handed_over = true;
+      writer.Split(slot, file->chunks.size());
+      for (size_t c = 0; c < file->chunks.size(); ++c) {
+        if (needs_linenum) {
+          pool.Submit([&, file, slot, c](size_t) { count_chunk(file, slot, c); });
+        } else {
+          pool.Submit([&, file, chunk = Child(slot, c)](size_t w) { process_chunk(file, chunk, w); });
+        }
+      }
+    } catch (...) {
+      if (!handed_over) writer.Complete(slot, worker_buffers[worker]);
+      throw;
+    }
+  };
+
+  // small files are read a batch at a time, the rest gets a task of its own
+  auto process_batch = [&](const std::vector<Slot>& slots, const std::vector<std::string>& paths, size_t worker) {
+    std::unique_ptr<BatchReader>& reader = worker_readers[worker];
+    if (!reader) reader = std::make_unique<BatchReader>(use_io_uring);
+    const std::vector<BatchedFile>& read = reader->Read(paths);
+
+    std::optional<Range>& range = worker_ranges[worker];
+    std::string& buffer = worker_buffers[worker];
+    // a file that fails completes its slot like any other and the batch goes
+    // on, so no slot is left open; the first error is raised at the end
+    std::exception_ptr error;
+    for (size_t k = 0; k < read.size(); ++k) {
+      if (read[k].deferred) {
+        pool.Submit([&, slot = slots[k], path = paths[k]](size_t w) { process_file(slot, path, w); });
+        continue;
+      }
+      if (read[k].ok) {
+        try {
+          if (range) range->Reset();
+          OutputSink sink(buffer, output.verbose, output.delimiter);
+          output.Configure(sink);
+          sink.SetFilename(paths[k]);
+          ProcessFileContents(p, sink, range, paths[k], read[k].contents);
+          sink.EndFile();
+        } catch (...) {
+          if (!error) error = std::current_exception();
+        }
+      }
+      writer.Complete(slots[k], buffer);
+    }
+    if (error) std::rethrow_exception(error);
+  };
+
+  auto submit_files = [&](std::vector<Slot>& slots, std::vector<std::string>& paths) {
+    for (size_t begin = 0; begin < paths.size(); begin += BatchReader::kMaxBatch) {
+      const size_t end = std::min(begin + BatchReader::kMaxBatch, paths.size());
+      std::vector<Slot> batch_slots(std::make_move_iterator(slots.begin() + begin),
+                                    std::make_move_iterator(slots.begin() + end));
+      std::vector<std::string> batch(std::make_move_iterator(paths.begin() + begin),
+                                     std::make_move_iterator(paths.begin() + end));
+      pool.Submit([&, batch_slots = std::move(batch_slots), batch = std::move(batch)](size_t worker) {
+        process_batch(batch_slots, batch, worker);
+      });
+    }
+    slots.clear();
+    paths.clear();
+  };
+  // the listing splits the directory's slot into one per entry, files and
+  // subdirectories alike, in the order a serial walk visits them
+  std::function<void(Slot, std::string)> submit_directory = [&](Slot slot, std::string path) {
+    pool.Submit([&, slot = std::move(slot), path = std::move(path)](size_t) {
+      std::vector<Slot> file_slots;
+      std::vector<std::string> files;
+      size_t entries = 0;
+      try {
+        ListDirectory(
+          path, walk_options,
+          [&](std::string file) {
+            file_slots.push_back(Child(slot, entries++));
+            files.push_back(std::move(file));
+          },
+          [&](std::string directory) { submit_directory(Child(slot, entries++), std::move(directory)); });
+      } catch (...) {
+        writer.Split(slot, 0);
+        throw;
+      }
+      writer.Split(slot, entries);
+      submit_files(file_slots, files);
+    });
+  };
+
+  std::vector<Slot> slots;
+  std::vector<std::string> listed;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    std::string path{inputs[i]};
+    if (IsDirectory(path)) {
+      submit_directory(Slot{i}, std::move(path));
+    } else {
+      slots.push_back(Slot{i});
+      listed.push_back(std::move(path));
+    }
+  }
+  submit_files(slots, listed);
+  pool.Wait();
+}
+
+} // namespace gai
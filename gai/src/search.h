@@ -0,0 +1,59 @@
+#ifndef GAI_SEARCH_H_
+#define GAI_SEARCH_H_
+
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "loader.h"
+#include "output.h"
+#include "process.h"
+#include "walk.h"
+
+namespace gai {
+
+// How the command line sets up every sink.
+struct OutputOptions {
+  bool verbose{false};
+  std::string_view delimiter;
+  size_t before_context{0};
+  size_t after_context{0};
+  OutputSink::Mode mode{OutputSink::Mode::kLines};
+  size_t max_count{0};
+  // capture groups printed by -o, empty for whole lines
+  std::vector<size_t> groups;
+
+  void Configure(OutputSink& sink) const {
+    sink.SetContext(before_context, after_context);
+    sink.SetMode(mode);
+    sink.SetMaxCount(max_count);
+    sink.SetGroups(groups);
+  }
+  // Context, counts and limits follow a file from its first line on, such
+  // files are not split into chunks.
+  bool NeedsWholeFile() const {
+    return (before_context > 0) || (after_context > 0) || (mode != OutputSink::Mode::kLines) || (max_count > 0);
+  }
+};
+
+// ProcessContents() for the file `path`. A compressed file that turns out to
+// be corrupt or truncated is reported on stderr and the run goes on with the
+// next file, as after an unreadable one; lines printed before the damage was
+// found stay printed.
+void ProcessFileContents(const Patterns& p, OutputSink& sink, std::optional<Range>& range, const std::string& path,
+                         std::string_view contents);
+
+// Searches the files and directories in `inputs` with `threads` workers and
+// writes to `stream` exactly what a single-threaded walk would: inputs in
+// order, the entries of a directory in name order with subdirectories in
+// place. Directories are listed by the workers, in parallel with the matching
+// of files found so far.
+void ProcessFilesParallel(const std::vector<std::string_view>& inputs, const WalkOptions& walk_options,
+                          size_t threads, bool use_io_uring, const common::LoadOptions& load_options,
+                          const Patterns& p, const OutputOptions& output, FILE* stream = stdout);
+
+} // namespace gai
+
+#endif // GAI_SEARCH_H_
@@ -0,0 +1,295 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "simd.h"
+
+namespace gai {
+
+size_t FindLiteral(std::string_view haystack, std::string_view needle) {
+  const size_t k = needle.size();
+  if (k == 0) return 0;
+  if (k > haystack.size()) return std::string_view::npos;
+  if (k == 1) {
+    const void* p = std::memchr(haystack.data(), needle.front(), haystack.size());
+    return p ? static_cast<const char*>(p) - haystack.data() : std::string_view::npos;
+  }
+
+  size_t i = 0;
+#if defined(__AVX2__)
+  const char* const h = haystack.data();
+  const size_t n = haystack.size();
+  const __m256i first = _mm256_set1_epi8(needle.front());
+  const __m256i last = _mm256_set1_epi8(needle.back());
+  for (; i + k - 1 + 32 <= n; i += 32) {
+    const __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(h + i));
+    const __m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(h + i + k - 1));
+    const __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first),
+                                        _mm256_cmpeq_epi8(last, block_last));
+    uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(eq));
+    while (mask != 0) {
+      const size_t candidate = i + __builtin_ctz(mask);
+      if (std::memcmp(h + candidate + 1, needle.data() + 1, k - 2) == 0) return candidate;
+      mask &= mask - 1;
+    }
+  }
+#endif
+  // tail, or everything when built without AVX2
+  const size_t pos = haystack.substr(i).find(needle);
+  return (pos == std::string_view::npos) ? pos : i + pos;
+}
+
+size_t CountNewlines(std::string_view content) {
+  const char* const c = content.data();
+  const size_t n = content.size();
+  size_t count = 0;
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256i newline = _mm256_set1_epi8('\n');
+  const __m256i zero = _mm256_setzero_si256();
+  while (i + 32 <= n) {
+    // a matching byte compares to -1, subtracting it counts up to 255 per lane
+    const size_t end = i + 32 * std::min<size_t>((n - i) / 32, 255);
+    __m256i counters = zero;
+    for (; i < end; i += 32) {
+      const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c + i));
+      counters = _mm256_sub_epi8(counters, _mm256_cmpeq_epi8(block, newline));
+    }
+    const __m256i sums = _mm256_sad_epu8(counters, zero);
+    count += static_cast<size_t>(_mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1) +
+                                 _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3));
+  }
+#endif
+  // tail, or everything when built without AVX2
+  return count + static_cast<size_t>(std::count(c + i, c + n, '\n'));
+}
+
+size_t IndexNewlines(std::string_view content, size_t* offsets, size_t max) {
+  const char* const c = content.data();
+  const size_t n = content.size();
+  size_t count = 0;
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256i newline = _mm256_set1_epi8('\n');
+  for (; (i + 64 <= n) && (count < max); i += 64) {
+    const __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c + i));
+    const __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c + i + 32));
+    uint64_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, newline))) |
+                    (uint64_t{static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, newline)))} << 32);
+    while ((mask != 0) && (count < max)) {
+      offsets[count++] = i + static_cast<size_t>(__builtin_ctzll(mask));
+      mask &= mask - 1;
+    }
+    if (count == max) return count;
+  }
+#endif
+  // tail, or everything when built without AVX2
+  while ((i < n) && (count < max)) {
+    const void* p = std::memchr(c + i, '\n', n - i);
+    if (!p) break;
+    offsets[count] = static_cast<size_t>(static_cast<const char*>(p) - c);
+    i = offsets[count++] + 1;
+  }
+  return count;
+}
+
+size_t SkipLines(std::string_view content, size_t lines) {
+  if (lines == 0) return 0;
+  const char* const c = content.data();
+  const size_t n = content.size();
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256i newline = _mm256_set1_epi8('\n');
+  for (; i + 64 <= n; i += 64) {
+    const __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c + i));
+    const __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c + i + 32));
+    uint64_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, newline))) |
+                    (uint64_t{static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, newline)))} << 32);
+    const size_t found = static_cast<size_t>(__builtin_popcountll(mask));
+    if (found < lines) {
+      lines -= found;
+      continue;
+    }
+    while (--lines > 0) mask &= mask - 1;
+    return i + static_cast<size_t>(__builtin_ctzll(mask)) + 1;
+  }
+#endif
+  // tail, or everything when built without AVX2
+  while (i < n) {
+    const void* p = std::memchr(c + i, '\n', n - i);
+    if (!p) break;
+    i = static_cast<size_t>(static_cast<const char*>(p) - c) + 1;
+    if (--lines == 0) return i;
+  }
+  return std::string_view::npos;
+}
+
+// Length of the valid UTF-8 sequence at the start of `p`, 0 if there is none.
+static size_t Utf8SequenceLength(const unsigned char* p, size_t n) {
+  const unsigned char c = p[0];
+  auto continuation = [&](size_t k) { return (k < n) && ((p[k] & 0xC0) == 0x80); };
+  if (c < 0x80) return 1;
+  if (c < 0xC2) return 0;  // continuation byte or overlong two byte form
+  if (c < 0xE0) return continuation(1) ? 2 : 0;
+  if (c < 0xF0) {
+    if (!continuation(1) || !continuation(2)) return 0;
+    if ((c == 0xE0) && (p[1] < 0xA0)) return 0;   // overlong
+    if ((c == 0xED) && (p[1] >= 0xA0)) return 0;  // surrogate
+    return 3;
+  }
+  if (c < 0xF5) {
+    if (!continuation(1) || !continuation(2) || !continuation(3)) return 0;
+    if ((c == 0xF0) && (p[1] < 0x90)) return 0;   // overlong
+    if ((c == 0xF4) && (p[1] >= 0x90)) return 0;  // past U+10FFFF
+    return 4;
+  }
+  return 0;
+}
+
+// Scalar validation from `i`, which has to be the start of a sequence.
+static size_t ValidateUtf8From(const unsigned char* c, size_t n, size_t i) {
+  while (i < n) {
+    const size_t length = Utf8SequenceLength(c + i, n - i);
+    if (length == 0) return i;
+    i += length;
+  }
+  return std::string_view::npos;
+}
+
+#if defined(__AVX2__)
+// The lookup validation of Keiser and Lemire ("Validating UTF-8 in less than
+// one instruction per byte"): three 16 entry tables, indexed by the nibbles of
+// every byte and its predecessor, flag the invalid two byte combinations,
+// and the bytes two and three behind a lead byte are checked to be
+// continuations. Each table entry is a set of error classes, a pair of bytes
+// is invalid when all three lookups share one.
+namespace utf8 {
+constexpr uint8_t kTooShort = 1 << 0;    // lead byte or ASCII after a lead byte
+constexpr uint8_t kTooLong = 1 << 1;     // continuation after ASCII
+constexpr uint8_t kOverlong3 = 1 << 2;   // 11100000 100_____
+constexpr uint8_t kTooLarge = 1 << 3;    // above U+10FFFF
+constexpr uint8_t kSurrogate = 1 << 4;   // 11101101 101_____
+constexpr uint8_t kOverlong2 = 1 << 5;   // 1100000_ 10______
+constexpr uint8_t kTooLarge1000 = 1 << 6;
+constexpr uint8_t kOverlong4 = 1 << 6;   // 11110000 1000____
+constexpr uint8_t kTwoConts = 1 << 7;    // continuation after continuation
+constexpr uint8_t kCarry = kTooShort | kTooLong | kTwoConts;
+
+static __m256i Table(const uint8_t (&t)[16]) {
+  const __m128i half = _mm_loadu_si128(reinterpret_cast<const __m128i*>(t));
+  return _mm256_broadcastsi128_si256(half);
+}
+
+static __m256i HighNibbles(__m256i v) { return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F)); }
+
+// `input` shifted by `N` bytes, the bytes in front coming from `previous`.
+template <int N>
+static __m256i Prev(__m256i input, __m256i previous) {
+  return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(previous, input, 0x21), 16 - N);
+}
+
+struct Validator {
+  __m256i byte_1_high;
+  __m256i byte_1_low;
+  __m256i byte_2_high;
+  __m256i error = _mm256_setzero_si256();
+  __m256i previous = _mm256_setzero_si256();
+  __m256i previous_incomplete = _mm256_setzero_si256();
+
+  Validator() {
+    static constexpr uint8_t kByte1High[16] = {
+      kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong,
+      kTwoConts, kTwoConts, kTwoConts, kTwoConts,
+      kTooShort | kOverlong2,
+      kTooShort,
+      kTooShort | kOverlong3 | kSurrogate,
+      kTooShort | kTooLarge | kTooLarge1000 | kOverlong4};
+    static constexpr uint8_t kByte1Low[16] = {
+      kCarry | kOverlong3 | kOverlong2 | kOverlong4,
+      kCarry | kOverlong2,
+      kCarry,
+      kCarry,
+      kCarry | kTooLarge,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000 | kSurrogate,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000};
+    static constexpr uint8_t kByte2High[16] = {
+      kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort,
+      kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge1000 | kOverlong4,
+      kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge,
+      kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+      kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+      kTooShort, kTooShort, kTooShort, kTooShort};
+    byte_1_high = Table(kByte1High);
+    byte_1_low = Table(kByte1Low);
+    byte_2_high = Table(kByte2High);
+  }
+
+  void Check(__m256i input) {
+    const __m256i prev1 = Prev<1>(input, previous);
+    const __m256i special =
+      _mm256_and_si256(_mm256_and_si256(_mm256_shuffle_epi8(byte_1_high, HighNibbles(prev1)),
+                                        _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)))),
+                       _mm256_shuffle_epi8(byte_2_high, HighNibbles(input)));
+    // the second byte after a three or four byte lead and the third after a
+    // four byte lead have to be continuations, which the tables flag as kTwoConts
+    const __m256i third = _mm256_subs_epu8(Prev<2>(input, previous), _mm256_set1_epi8(char(0xE0 - 0x80)));
+    const __m256i fourth = _mm256_subs_epu8(Prev<3>(input, previous), _mm256_set1_epi8(char(0xF0 - 0x80)));
+    const __m256i must_continue = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8(char(0x80)));
+    error = _mm256_or_si256(error, _mm256_xor_si256(must_continue, special));
+    // a lead byte in the last three bytes needs bytes from the next block
+    const __m256i max = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                         -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, char(0xF0 - 1), char(0xE0 - 1),
+                                         char(0xC0 - 1));
+    previous_incomplete = _mm256_subs_epu8(input, max);
+    previous = input;
+  }
+
+  void Ascii(__m256i input) {
+    error = _mm256_or_si256(error, previous_incomplete);
+    previous_incomplete = _mm256_setzero_si256();
+    previous = input;
+  }
+
+  bool Failed() const { return !_mm256_testz_si256(error, error); }
+};
+}  // namespace utf8
+#endif
+
+size_t ValidateUtf8(std::string_view content) {
+  const auto* const c = reinterpret_cast<const unsigned char*>(content.data());
+  const size_t n = content.size();
+  size_t i = 0;
+#if defined(__AVX2__)
+  utf8::Validator validator;
+  for (; i + 64 <= n; i += 64) {
+    const __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c + i));
+    const __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c + i + 32));
+    if (_mm256_movemask_epi8(_mm256_or_si256(low, high)) == 0) {
+      validator.Ascii(high);
+    } else {
+      validator.Check(low);
+      validator.Check(high);
+    }
+    if (validator.Failed()) break;
+  }
+#endif
+  // the exact offset, and the tail, are found by decoding from the start of
+  // the sequence that reaches into the block, at most three bytes back
+  size_t start = (i >= 3) ? i - 3 : 0;
+  while ((start < i) && ((c[start] & 0xC0) == 0x80)) ++start;
+  return ValidateUtf8From(c, n, start);
+}
+
+} // namespace gai
@@ -0,0 +1,35 @@
+#ifndef GAI_SIMD_H_
+#define GAI_SIMD_H_
+
+#include <string_view>
+
+namespace gai {
+
+// Offset of the first occurrence of `needle` in `haystack`, npos if there is
+// none. Compares the first and last byte of the needle across a whole vector
+// at once and only runs memcmp on candidate positions.
+size_t FindLiteral(std::string_view haystack, std::string_view needle);
+
+// Number of '\n' in `content`. Compares a vector of bytes at a time and
+// sums the matches in byte counters that are widened every 255 vectors.
+size_t CountNewlines(std::string_view content);
+
+// Offsets of the first `max` '\n' in `content`, written to `offsets`;
+// returns how many were found. Compares 64 bytes at a time and extracts the
+// offsets from the bits of the comparison mask, without a call per line.
+size_t IndexNewlines(std::string_view content, size_t* offsets, size_t max);
+
+// Offset just past the `lines`-th '\n' of `content` (0 for no lines), npos
+// if it has fewer. Counts a 64 byte block at a time and only looks for the
+// exact newline within the block that holds it.
+size_t SkipLines(std::string_view content, size_t lines);
+
+// Offset of the first byte of `content` that does not start a valid UTF-8
+// sequence (overlong forms, surrogates and code points past U+10FFFF are
+// invalid), npos if all of it is valid. Runs of ASCII are skipped a vector
+// at a time, only the other sequences are decoded one by one.
+size_t ValidateUtf8(std::string_view content);
+
+} // namespace gai
+
+#endif // GAI_SIMD_H_
@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <charconv>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "stats.h"
+#include "printx.hpp"
+
+namespace gai {
+
+bool stats_enabled = false;
+thread_local ThreadStats* thread_stats = nullptr;
+
+// What was tracked and the tables of every thread that counted anything.
+// Tables outlive their threads, workers are gone by the time of the report.
+struct StatsRegistry {
+  struct Pattern {
+    std::string kind;
+    std::string pattern;
+    bool jitted{false};
+    // pattern whose evaluations and time stand for this one's: itself, or
+    // the combined program it was merged into
+    size_t program{0};
+    // patterns merged into this one, a combined program is only reported
+    // through them
+    size_t members{0};
+  };
+
+  std::mutex mutex;
+  std::vector<Pattern> patterns;
+  std::vector<std::unique_ptr<ThreadStats>> threads;
+  std::chrono::steady_clock::time_point start;
+
+  static StatsRegistry& Instance() {
+    static StatsRegistry registry;
+    return registry;
+  }
+};
+
+void EnableStats() {
+  StatsRegistry::Instance().start = std::chrono::steady_clock::now();
+  stats_enabled = true;
+}
+
+ThreadStats& RegisterThreadStats() {
+  StatsRegistry& registry = StatsRegistry::Instance();
+  std::lock_guard lock(registry.mutex);
+  thread_stats = registry.threads.emplace_back(std::make_unique<ThreadStats>()).get();
+  return *thread_stats;
+}
+
+void TrackPattern(std::string_view kind, const Pcre2Compiled& re) {
+  if (!stats_enabled) return;
+  StatsRegistry& registry = StatsRegistry::Instance();
+  std::lock_guard lock(registry.mutex);
+  re.stats_id = registry.patterns.size();
+  registry.patterns.push_back({std::string{kind}, re.pattern, re.jitted, re.stats_id});
+}
+
+void TrackPatternSet(std::string_view kind, const Pcre2PatternSet& set) {
+  if (!stats_enabled) return;
+  StatsRegistry& registry = StatsRegistry::Instance();
+  std::lock_guard lock(registry.mutex);
+  set.stats_ids.assign(set.size, 0);
+  for (size_t k = 0; k < set.matchers.size(); ++k) {
+    const Pcre2Compiled& re = set.matchers[k].re;
+    re.stats_id = registry.patterns.size();
+    if (set.ids[k] != Pcre2PatternSet::kCombined) {
+      set.stats_ids[set.ids[k]] = re.stats_id;
+      registry.patterns.push_back({std::string{kind}, set.patterns[set.ids[k]], re.jitted, re.stats_id});
+      continue;
+    }
+    registry.patterns.push_back({std::string{kind}, re.pattern, re.jitted, re.stats_id});
+    // members cannot hold (* themselves, every mark names one of them; they
+    // are listed in input order
+    constexpr std::string_view kMark = "(*MARK:";
+    std::vector<size_t> members;
+    for (size_t at = re.pattern.find(kMark); at != std::string::npos; at = re.pattern.find(kMark, at + 1)) {
+      std::from_chars(re.pattern.data() + at + kMark.size(), re.pattern.data() + re.pattern.size(),
+                      members.emplace_back(0));
+    }
+    std::sort(members.begin(), members.end());
+    for (const size_t member : members) {
+      set.stats_ids[member] = registry.patterns.size();
+      registry.patterns.push_back({std::string{kind}, set.patterns[member], re.jitted, re.stats_id});
+      ++registry.patterns[re.stats_id].members;
+    }
+  }
+}
+
+static double Milliseconds(uint64_t ns) { return double(ns) / 1e6; }
+
+void ReportStats(FILE* stream) {
+  if (!stats_enabled) return;
+  StatsRegistry& registry = StatsRegistry::Instance();
+  std::lock_guard lock(registry.mutex);
+  const double wall_ms =
+    Milliseconds(uint64_t(std::chrono::nanoseconds(std::chrono::steady_clock::now() - registry.start).count()));
+
+  ThreadStats total;
+  total.patterns.resize(registry.patterns.size());
+  for (const std::unique_ptr<ThreadStats>& thread : registry.threads) {
+    for (size_t k = 0; k < thread->patterns.size(); ++k) {
+      total.patterns[k].evaluations += thread->patterns[k].evaluations;
+      total.patterns[k].hits += thread->patterns[k].hits;
+      total.patterns[k].timed += thread->patterns[k].timed;
+      total.patterns[k].timed_ns += thread->patterns[k].timed_ns;
+    }
+    for (size_t s = 0; s < total.stage_ns.size(); ++s) total.stage_ns[s] += thread->stage_ns[s];
+    total.bytes += thread->bytes;
+    total.lines += thread->lines;
+  }
+
+  // time of the evaluations that were not timed is estimated from the ones that were
+  // and a pattern of a combined program shows the program's, with the number
+  // of patterns that share them
+  for (size_t k = 0; k < registry.patterns.size(); ++k) {
+    const StatsRegistry::Pattern& pattern = registry.patterns[k];
+    if (pattern.members > 0) continue;
+    const PatternCounters& counters = total.patterns[pattern.program];
+    const double ms = (counters.timed == 0) ? 0.0
+                                            : Milliseconds(counters.timed_ns) * double(counters.evaluations) /
+                                                double(counters.timed);
+    rostd::fprintf<"%s\t%s\tjit=%s\tevaluations=%llu\thits=%llu\ttime=%.3fms">(
+      stream, pattern.kind, pattern.pattern, pattern.jitted ? "yes" : "no",
+      (unsigned long long)counters.evaluations, (unsigned long long)total.patterns[k].hits, ms);
+    if (pattern.program != k) {
+      rostd::fprintf<"\tcombined=%zu">(stream, registry.patterns[pattern.program].members);
+    }
+    std::fputc('\n', stream);
+  }
+  // stage times are summed over threads and can add up to more than the wall time
+  rostd::fprintf<"input\tbytes=%llu\tlines=%llu\ttime=%.3fms\n">(
+    stream, (unsigned long long)total.bytes, (unsigned long long)total.lines,
+    Milliseconds(total.stage_ns[size_t(Stage::kInput)]));
+  rostd::fprintf<"match\ttime=%.3fms\n">(stream, Milliseconds(total.stage_ns[size_t(Stage::kMatch)]));
+  rostd::fprintf<"output\ttime=%.3fms\n">(stream, Milliseconds(total.stage_ns[size_t(Stage::kOutput)]));
+  const double mb_per_s = (wall_ms > 0) ? (double(total.bytes) / (1 << 20)) / (wall_ms / 1000) : 0.0;
+  rostd::fprintf<"total\ttime=%.3fms\tthroughput=%.1fMB/s\tthreads=%zu\n">(stream, wall_ms, mb_per_s,
+                                                                        registry.threads.size());
+}
+
+} // namespace gai
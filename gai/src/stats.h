@@ -0,0 +1,147 @@
+#ifndef GAI_STATS_H_
+#define GAI_STATS_H_
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string_view>
+#include <vector>
+
+#include "regex.h"
+
+namespace gai {
+
+// Counters behind --stats. Nothing is counted until EnableStats() is called.
+// Every thread counts into a table of its own, so counting takes no locks
+// and shares no cache lines; ReportStats() adds the tables up.
+//
+// Patterns are counted once they are tracked (TrackPattern): every
+// evaluation and hit is counted, but only one evaluation in kSampleEvery is
+// timed and the time of the others is extrapolated from it, which keeps
+// clock reads out of the per line path. Stages are timed per call of the
+// functions that read input, scan it and write output, never per line.
+enum class Stage { kInput, kMatch, kOutput, kCount };
+
+struct PatternCounters {
+  uint64_t evaluations{0};
+  uint64_t hits{0};
+  uint64_t timed{0};  // evaluations that were timed
+  uint64_t timed_ns{0};
+};
+
+struct alignas(64) ThreadStats {
+  std::vector<PatternCounters> patterns;
+  std::array<uint64_t, size_t(Stage::kCount)> stage_ns{};
+  uint64_t bytes{0};
+  uint64_t lines{0};
+  // stage timed by the innermost StageTimer of the thread
+  Stage current{Stage::kCount};
+  std::chrono::steady_clock::time_point current_start;
+};
+
+constexpr uint64_t kSampleEvery = 64;
+
+extern bool stats_enabled;
+extern thread_local ThreadStats* thread_stats;
+
+void EnableStats();
+inline bool StatsEnabled() { return stats_enabled; }
+// Creates the table of the calling thread.
+ThreadStats& RegisterThreadStats();
+inline ThreadStats& LocalStats() { return thread_stats ? *thread_stats : RegisterThreadStats(); }
+
+// Counts `re` as `kind` (filter, exclude, replace...) from now on.
+void TrackPattern(std::string_view kind, const Pcre2Compiled& re);
+// TrackPattern() for every pattern of `set`. Patterns merged into a combined
+// program are reported as given, with the evaluations and time of their
+// program and the hits its mark attributes to them (see FindAny()).
+void TrackPatternSet(std::string_view kind, const Pcre2PatternSet& set);
+
+// Input the scan went through.
+inline void CountInput(size_t bytes, size_t lines) {
+  if (!stats_enabled) return;
+  ThreadStats& stats = LocalStats();
+  stats.bytes += bytes;
+  stats.lines += lines;
+}
+
+// Counts a hit of a pattern that was evaluated as part of a combined program.
+inline void CountHit(size_t stats_id) {
+  ThreadStats& stats = LocalStats();
+  if (stats_id >= stats.patterns.size()) stats.patterns.resize(stats_id + 1);
+  ++stats.patterns[stats_id].hits;
+}
+
+// Counts one evaluation of a pattern and times it if it is sampled.
+class PatternSample {
+ public:
+  explicit PatternSample(const Pcre2Compiled& re) {
+    if (re.stats_id == Pcre2Compiled::kNotTracked) return;
+    ThreadStats& stats = LocalStats();
+    if (re.stats_id >= stats.patterns.size()) stats.patterns.resize(re.stats_id + 1);
+    counters_ = &stats.patterns[re.stats_id];
+    if ((counters_->evaluations++ % kSampleEvery) == 0) {
+      timed_ = true;
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+  ~PatternSample() {
+    if (!timed_) return;
+    ++counters_->timed;
+    counters_->timed_ns += uint64_t(std::chrono::nanoseconds(std::chrono::steady_clock::now() - start_).count());
+  }
+  PatternSample(const PatternSample&) = delete;
+  PatternSample& operator=(const PatternSample&) = delete;
+
+  bool Hit(bool hit) {
+    if (hit && counters_) ++counters_->hits;
+    return hit;
+  }
+
+ private:
+  PatternCounters* counters_{nullptr};
+  bool timed_{false};
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Adds the time until it goes out of scope to `stage`. Timers nest: an inner
+// timer pauses the outer one, so every moment is counted once, in the stage
+// of the innermost timer.
+class StageTimer {
+ public:
+  explicit StageTimer(Stage stage) {
+    if (!stats_enabled) return;
+    stats_ = &LocalStats();
+    const auto now = std::chrono::steady_clock::now();
+    outer_ = stats_->current;
+    if (outer_ != Stage::kCount) Add(outer_, now);
+    stats_->current = stage;
+    stats_->current_start = now;
+  }
+  ~StageTimer() {
+    if (!stats_) return;
+    const auto now = std::chrono::steady_clock::now();
+    Add(stats_->current, now);
+    stats_->current = outer_;
+    stats_->current_start = now;
+  }
+  StageTimer(const StageTimer&) = delete;
+  StageTimer& operator=(const StageTimer&) = delete;
+
+ private:
+  void Add(Stage stage, std::chrono::steady_clock::time_point now) {
+    stats_->stage_ns[size_t(stage)] += uint64_t(std::chrono::nanoseconds(now - stats_->current_start).count());
+  }
+
+  ThreadStats* stats_{nullptr};
+  Stage outer_{Stage::kCount};
+};
+
+// Prints the pattern and stage counters of all threads to `stream`. Threads
+// that are still counting must have finished.
+void ReportStats(FILE* stream);
+
+} // namespace gai
+
+#endif // GAI_STATS_H_
@@ -1,12 +1,38 @@
+#include <algorithm>
+#include <cstdio>
 #include <cstdlib>
 #include <exception>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <optional>
 #include <string>
+#include <thread>
 #include <vector>
+#include <unistd.h>
 
+#include "batch_read.h"
+#include "decompress.h"
+#include "disk_entry.h"
+#include "follow.h"
+#include "input.h"
+#include "line_index.h"
+#include "loader.h"
 #include "operation.h"
+#include "output.h"
+#include "parallel.h"
+#include "pattern_cache.h"
+#include "pipeline.h"
+#include "process.h"
 #include "regex.h"
+#include "search.h"
+#include "simd.h"
+#include "stats.h"
+#include "walk.h"
+
+#include <zlib.h>
+#include <zstd.h>
 
 #define EXPECT_TRUE(expr)                                                                              \
   do {                                                                                                 \
@@ -28,6 +54,101 @@
     }                                                                                                                  \
   } while (0)
 
+// Runs Process (line by line) or ProcessBuffer over `content` and collects
+// "linenum:line" records.
+static std::string RunProcess(std::string_view content, std::string_view filter, bool whole_buffer,
+                              std::string_view range_expr = "", size_t before = 0, size_t after = 0) {
+  const gai::Pcre2PatternSet filters = gai::CompileSet({filter}, true, false);
+  std::optional<gai::Range> range = gai::ParseRange(range_expr, true, false);
+  std::string out;
+  gai::OutputSink sink(out, true, ":");
+  sink.SetContext(before, after);
+  if (whole_buffer) {
+    gai::ProcessBuffer(filters, {}, {}, sink, range, content);
+  } else {
+    gai::InputMemMappedFile input(content.data(), content.data() + content.size());
+    gai::Process(filters, {}, {}, sink, range, &input);
+  }
+  return out;
+}
+
+// gzip member holding `data`.
+static std::string Gzip(std::string_view data) {
+  z_stream zs{};
+  deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+  std::string out(deflateBound(&zs, data.size()) + 32, '\0');
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  zs.avail_in = static_cast<uInt>(data.size());
+  zs.next_out = reinterpret_cast<Bytef*>(out.data());
+  zs.avail_out = static_cast<uInt>(out.size());
+  deflate(&zs, Z_FINISH);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return out;
+}
+
+static std::string Zstd(std::string_view data) {
+  std::string out(ZSTD_compressBound(data.size()), '\0');
+  out.resize(ZSTD_compress(out.data(), out.size(), data.data(), data.size(), 1));
+  return out;
+}
+
+// Writes `contents` to `path`, replacing the file or appended to it.
+static void WriteFile(const std::filesystem::path& path, std::string_view contents, bool append = false) {
+  std::FILE* f = std::fopen(path.c_str(), append ? "ab" : "wb");
+  if (!f) return;
+  std::fwrite(contents.data(), 1, contents.size(), f);
+  std::fclose(f);
+}
+
+// Anonymous temporary file holding `contents`, positioned at its start.
+static std::FILE* TempFile(std::string_view contents) {
+  std::FILE* f = std::tmpfile();
+  std::fwrite(contents.data(), 1, contents.size(), f);
+  std::fflush(f);
+  std::rewind(f);
+  return f;
+}
+
+// Everything written to `f` so far.
+static std::string ReadBack(std::FILE* f) {
+  std::fflush(f);
+  std::rewind(f);
+  std::string contents;
+  char chunk[4096];
+  for (size_t n; (n = std::fread(chunk, 1, sizeof(chunk), f)) > 0;) contents.append(chunk, n);
+  return contents;
+}
+
+// Empty directory gai_tests_<name> under the temporary directory, removed
+// with its contents when the scope ends.
+class TempDir {
+ public:
+  explicit TempDir(std::string_view name)
+    : path_{std::filesystem::temp_directory_path() / std::string{"gai_tests_"}.append(name)} {
+    std::filesystem::remove_all(path_);
+    std::filesystem::create_directories(path_);
+  }
+  ~TempDir() {
+    std::error_code ec;
+    std::filesystem::remove_all(path_, ec);
+  }
+  TempDir(const TempDir&) = delete;
+  TempDir& operator=(const TempDir&) = delete;
+
+  const std::filesystem::path& Path() const { return path_; }
+  std::filesystem::path operator/(std::string_view name) const { return path_ / name; }
+
+ private:
+  std::filesystem::path path_;
+};
+
+static std::vector<std::string> ReadLines(gai::InputBase& input) {
+  std::vector<std::string> lines;
+  while (std::optional<std::string_view> line = input.GetLine()) lines.emplace_back(*line);
+  return lines;
+}
+
 static std::string RunSub(const gai::Pcre2Substitution& sub, std::string_view input) {
   static std::string scratch(512, ' ');
   std::string_view result = gai::Substitute(sub, input, scratch);
@@ -148,11 +269,29 @@ int main() {
     EXPECT_TRUE(RunSub(sub, "aaaa") == "Xaa");
   }
 
+  // Substitutions longer than the scratch buffer and chains
+  {
+    auto sub = Pcre2Substitution(Compile("x+", true, false), "<$0$0>");
+    std::string small(4, ' ');
+    const std::string line = "a" + std::string(20000, 'x') + "b";
+    EXPECT_TRUE(Substitute(sub, line, small) == "a<" + std::string(40000, 'x') + ">b");
+
+    std::vector<Pcre2Substitution> chain;
+    chain.emplace_back(Compile("a", true, false), "AA");
+    chain.emplace_back(Compile("zzz", true, false), "-");
+    chain.emplace_back(Compile("b", true, false), "BBB");
+    chain.emplace_back(Compile("A", true, false), "c");
+    std::array<std::string, 2> buffers{std::string(2, ' '), std::string(2, ' ')};
+    EXPECT_TRUE(SubstituteAll(chain, "ab", buffers) == "cABBB");
+    const std::string_view untouched = "nothing";
+    EXPECT_TRUE(SubstituteAll(chain, untouched, buffers).data() == untouched.data());
+  }
+
   // Range / Filters / ParseSub
   {
     Range r;
-    r.start = Regex(Compile("start", false, false));
-    r.end = Regex(Compile("end", false, false));
+    r.start = std::make_shared<const Pcre2Regex>(Compile("start", false, false));
+    r.end = std::make_shared<const Pcre2Regex>(Compile("end", false, false));
     EXPECT_TRUE(!r.IsStartReached("no match", 1));
     EXPECT_TRUE(r.IsStartReached("this is start line", 1));
     EXPECT_TRUE(!r.IsEndReached("no match", 2));
@@ -195,5 +334,901 @@ int main() {
   EXPECT_TRUE(ParseRange("@1@end@", false, false).has_value());
   EXPECT_THROWS(ParseRange("@start@", false, false));
 
+  // Range::Seek matches line by line evaluation
+  {
+    for (const char* expr : {"@3@6@", "@@4@", "@5@@", "@6@3@", "@0@2@"}) {
+      auto walked = ParseRange(expr, false, false);
+      auto seeked = ParseRange(expr, false, false);
+      EXPECT_TRUE(walked->IsLineBased());
+      for (size_t linenum = 1; linenum <= 10; ++linenum) {
+        const bool in_walked = walked->IsStartReached("", linenum) && !walked->IsEndReached("", linenum);
+        seeked->Seek(linenum - 1);
+        const bool in_seeked = seeked->IsStartReached("", linenum) && !seeked->IsEndReached("", linenum);
+        EXPECT_TRUE(in_walked == in_seeked);
+      }
+    }
+    EXPECT_TRUE(!ParseRange("@2@end@", false, false)->IsLineBased());
+  }
+
+  // SplitIntoChunks / CountNewlines
+  {
+    const std::string_view content = "aa\nbbbb\nc\n\ndddd";
+    auto chunks = SplitIntoChunks(content, 3);
+    EXPECT_TRUE(chunks.size() == 4u);
+    EXPECT_TRUE(chunks[0] == "aa\n");
+    EXPECT_TRUE(chunks[1] == "bbbb\n");
+    EXPECT_TRUE(chunks[2] == "c\n\n");
+    EXPECT_TRUE(chunks[3] == "dddd");
+    EXPECT_TRUE(SplitIntoChunks(content, 100).size() == 1u);
+    EXPECT_TRUE(SplitIntoChunks("", 10).empty());
+    EXPECT_TRUE(CountNewlines(content) == 4u);
+
+    // long enough for the vector loops, the byte counters and the tails
+    std::string lines;
+    for (int i = 1; i <= 3000; ++i) lines.append(std::string(i % 7, 'x')).append("\n");
+    lines.append("tail");
+    EXPECT_TRUE(CountNewlines(lines) == 3000u);
+    EXPECT_TRUE(CountNewlines(std::string(20000, '\n')) == 20000u);
+    EXPECT_TRUE(SkipLines(lines, 0) == 0u);
+    EXPECT_TRUE(SkipLines(content, 2) == 8u);
+    EXPECT_TRUE(SkipLines(content, 5) == std::string_view::npos);
+    for (const size_t n : {1u, 63u, 64u, 65u, 1000u, 2999u, 3000u}) {
+      const size_t offset = SkipLines(lines, n);
+      EXPECT_TRUE((offset != std::string_view::npos) && (lines[offset - 1] == '\n'));
+      EXPECT_TRUE(CountNewlines(std::string_view(lines).substr(0, offset)) == n);
+    }
+    EXPECT_TRUE(SkipLines(lines, 3001) == std::string_view::npos);
+
+    std::vector<size_t> offsets(4000);
+    EXPECT_TRUE(IndexNewlines(lines, offsets.data(), offsets.size()) == 3000u);
+    for (size_t k = 0, at = 0; k < 3000; at = offsets[k++] + 1) {
+      EXPECT_TRUE(offsets[k] == std::string_view(lines).find('\n', at));
+    }
+    EXPECT_TRUE(IndexNewlines(lines, offsets.data(), 100) == 100u);
+    EXPECT_TRUE(offsets[99] == SkipLines(lines, 100) - 1);
+    EXPECT_TRUE(IndexNewlines("no newline", offsets.data(), offsets.size()) == 0u);
+  }
+
+  // ValidateUtf8 finds the first invalid byte, also across vector blocks
+  {
+    EXPECT_TRUE(ValidateUtf8("") == std::string_view::npos);
+    EXPECT_TRUE(ValidateUtf8("ascii h\xC3\xA9 \xE6\x97\xA5 \xF0\x9F\x92\xBE \xF4\x8F\xBF\xBF") == std::string_view::npos);
+    for (const std::string_view bad : {"\x80", "\xC0\xAF", "\xE0\x9F\xBF", "\xED\xA0\x80", "\xF4\x90\x80\x80",
+                                       "\xF5\x80\x80\x80", "\xFF", "\xE2\x82", "\xC3x"}) {
+      for (const size_t at : {0u, 31u, 62u, 63u, 64u, 100u}) {
+        std::string text(at, 'a');
+        if (at > 8) text.replace(2, 5, "\xE6\x97\xA5\xC3\xA9");
+        text.append(bad).append(70, 'z');
+        EXPECT_TRUE(ValidateUtf8(text) == at);
+        EXPECT_TRUE(ValidateUtf8(std::string_view(text).substr(0, at + bad.size())) == at);
+      }
+    }
+  }
+
+  // GetLines hands out the lines GetLine would, Unread gives back a batch tail
+  {
+    const std::string_view content = "l1\n\nl3\nl4\nl5";
+    InputMemMappedFile input(content.data(), content.data() + content.size());
+    std::string_view batch[3];
+    EXPECT_TRUE(input.GetLines(batch, 3) == 3u);
+    EXPECT_TRUE((batch[0] == "l1") && batch[1].empty() && (batch[2] == "l3"));
+    input.Unread(2);
+    EXPECT_TRUE(input.GetLine() == "");
+    EXPECT_TRUE(input.GetLines(batch, 3) == 3u);
+    EXPECT_TRUE((batch[0] == "l3") && (batch[1] == "l4") && (batch[2] == "l5"));
+    EXPECT_TRUE(input.GetLines(batch, 3) == 0u);
+  }
+
+  // SliceToRange cuts off the lines a numeric range cannot reach
+  {
+    const std::string_view content = "l1\nl2\nl3\nl4\nl5\nl6";
+    const auto slice = [&](std::string_view expr, size_t linenum = 0) {
+      return SliceToRange(ParseRange(expr, false, false), content, linenum);
+    };
+    EXPECT_TRUE((slice("@3@5@").buffer == "l3\nl4\n") && (slice("@3@5@").linenum == 2u));
+    EXPECT_TRUE((slice("@@3@").buffer == "l1\nl2\n") && (slice("@@3@").linenum == 0u));
+    EXPECT_TRUE((slice("@5@@").buffer == "l5\nl6") && (slice("@5@@").linenum == 4u));
+    EXPECT_TRUE(slice("@5@2@").buffer == "l5\nl6");
+    EXPECT_TRUE(slice("@9@12@").buffer.empty());
+    EXPECT_TRUE((slice("@12@14@", 10).buffer == "l2\nl3\n") && (slice("@12@14@", 10).linenum == 11u));
+    EXPECT_TRUE(slice("@2@l4@").buffer == "l2\nl3\nl4\nl5\nl6");
+    EXPECT_TRUE(slice("@l2@4@").buffer == content);
+  }
+
+  // A passed line number end stops reading, even with a regex start
+  {
+    const std::string_view content = "a1\nb2\na3\na4\nb5\na6\n";
+    for (const char* expr : {"@2@4@", "@b@4@"}) {
+      std::optional<Range> range = ParseRange(expr, false, false);
+      InputMemMappedFile input(content.data(), content.data() + content.size());
+      std::string out;
+      OutputSink sink(out, false, ":");
+      Process(CompileSet({"a"}, true, false), {}, {}, sink, range, &input);
+      EXPECT_TRUE(out == "a3\n");
+      EXPECT_TRUE(range->IsFinished());
+      EXPECT_TRUE(input.GetLine() == "b5");
+    }
+  }
+
+  // Search
+  {
+    auto regex = Regex(Compile("b+", true, false));
+    auto span = Search(regex, "abba bbb", 3);
+    EXPECT_TRUE(span.has_value() && (span->start == 5u) && (span->end == 8u));
+    EXPECT_TRUE(!Search(regex, "abba", 3).has_value());
+    EXPECT_TRUE(regex.re.buffer_searchable);
+    EXPECT_TRUE(!Regex(Compile("a*", true, false)).re.buffer_searchable);
+    EXPECT_TRUE(!Regex(Compile("foo(?!bar)", true, false)).re.buffer_searchable);
+    EXPECT_TRUE(!Regex(Compile("foo\\z", true, false)).re.buffer_searchable);
+  }
+
+  // RequiredLiteral
+  {
+    EXPECT_TRUE(RequiredLiteral("ERROR.*timeout") == "timeout");
+    EXPECT_TRUE(RequiredLiteral("user_id=\\d+") == "user_id=");
+    EXPECT_TRUE(RequiredLiteral("colou?r") == "colo");
+    EXPECT_TRUE(RequiredLiteral("ab+cd") == "ab");
+    EXPECT_TRUE(RequiredLiteral("a\\.b\\.c") == "a.b.c");
+    EXPECT_TRUE(RequiredLiteral("(foo|bar)baz{2}") == "baz");
+    EXPECT_TRUE(RequiredLiteral("(ab){2}xy") == "xy");
+    EXPECT_TRUE(RequiredLiteral("x{,3}yz") == "yz");
+    EXPECT_TRUE(RequiredLiteral("\\p{Lu}abc[def]") == "abc");
+    EXPECT_TRUE(RequiredLiteral("\\Qa.b\\E+") == "a.b");
+    EXPECT_TRUE(RequiredLiteral("héllo?") == "héll");
+    EXPECT_TRUE(RequiredLiteral("foo|bar").empty());
+    EXPECT_TRUE(RequiredLiteral("(?i)error").empty());
+    EXPECT_TRUE(RequiredLiteral("a.b").empty());
+    EXPECT_TRUE(Compile("ERROR.*timeout", false, false).literal == "timeout");
+  }
+
+  // FindLiteral
+  {
+    std::string haystack(300, 'a');
+    haystack.replace(250, 6, "needle");
+    EXPECT_TRUE(FindLiteral(haystack, "needle") == 250u);
+    EXPECT_TRUE(FindLiteral(haystack, "needles") == std::string_view::npos);
+    EXPECT_TRUE(FindLiteral(haystack, "aaan") == 247u);
+    EXPECT_TRUE(FindLiteral(haystack, "e") == 251u);
+    EXPECT_TRUE(FindLiteral("short", "rt") == 3u);
+    EXPECT_TRUE(FindLiteral("ab", "abc") == std::string_view::npos);
+  }
+
+  // InputStream carries partial and long lines across blocks
+  {
+    const std::string content = "ab\n\n" + std::string(100, 'x') + "\nlast";
+    FILE* f = TempFile(content);
+    InputStream stream(fileno(f), 4);
+    std::vector<std::string> lines;
+    while (auto line = stream.GetLine()) lines.emplace_back(*line);
+    EXPECT_TRUE(lines.size() == 4u);
+    EXPECT_TRUE((lines[0] == "ab") && lines[1].empty() && (lines[2] == std::string(100, 'x')) && (lines[3] == "last"));
+    EXPECT_TRUE(!stream.GetLine().has_value());
+    std::fclose(f);
+  }
+
+  // OutputSink references source lines and copies everything else
+  {
+    FILE* f = std::tmpfile();
+    const std::string_view source = "one\ntwo\nthree";
+    const std::string copied = "copy";
+    const std::string large(100000, 'l');
+    {
+      OutputSink sink(fileno(f), true, ":");
+      sink.SetSource(source);
+      sink.SetFilename("f");
+      sink.Emit(source.substr(0, 3), 1);
+      sink.Emit(source.substr(4, 3), 2);
+      sink.Emit(copied, 7);
+      sink.Emit(source.substr(8), 3);
+      sink.Emit(large, 10);
+      sink.Flush();
+      sink.SetFilename({});
+      for (size_t i = 0; i < 5000; ++i) sink.Emit(source.substr(0, 3), i);
+    }
+    std::string expected = "f:1:one\nf:2:two\nf:7:copy\nf:3:three\nf:10:" + large + "\n";
+    for (size_t i = 0; i < 5000; ++i) expected += std::to_string(i) + ":one\n";
+    EXPECT_TRUE(ReadBack(f) == expected);
+    std::fclose(f);
+  }
+
+  // CompileSet / FindAny
+  {
+    const auto set = CompileSet({"alpha", "be+ta", "(g)(a)mma\\d", "\\Qdel.ta", "eps(?=ilon)", "(?<n>zeta)"},
+                                true, false);
+    EXPECT_TRUE(set.size == 6u);
+    EXPECT_TRUE(set.matchers.size() == 2u);
+    EXPECT_TRUE((set.ids[0] == Pcre2PatternSet::kCombined) && (set.ids[1] == 5u));
+    EXPECT_TRUE(FindAny(set, "x beeeta") == std::optional<size_t>{1});
+    EXPECT_TRUE(FindAny(set, "gamma7") == std::optional<size_t>{2});
+    EXPECT_TRUE(FindAny(set, "del.ta") == std::optional<size_t>{3});
+    EXPECT_TRUE(!FindAny(set, "delxta").has_value());
+    EXPECT_TRUE(FindAny(set, "epsilon") == std::optional<size_t>{4});
+    EXPECT_TRUE(FindAny(set, "zeta") == std::optional<size_t>{5});
+    EXPECT_TRUE(!FindAny(set, "eps omega").has_value());
+    EXPECT_TRUE(!set.matchers[0].re.buffer_searchable);  // lookahead in a member
+
+    EXPECT_TRUE(CompileSet({"a", "b", "c"}, true, false).matchers.size() == 3u);
+    EXPECT_THROWS(CompileSet({"a", "b", "c", "d)|(e"}, true, false));
+    // errors name the pattern that failed, never a combined program
+    try {
+      CompileSet({"a", "b", "c", "d)|(e"}, true, false);
+    } catch (const std::runtime_error& ex) {
+      const std::string_view what = ex.what();
+      EXPECT_TRUE(what.find("Pattern: d)|(e\n") != std::string_view::npos);
+      EXPECT_TRUE(what.find("(?|") == std::string_view::npos);
+    }
+    // a comment in extended mode would swallow the end of its member
+    const auto extended = CompileSet({"(?x) WARN # c", "a", "b", "c", "d", "(?ix: E r r )"}, true, false);
+    EXPECT_TRUE((extended.ids.size() == 3u) && (extended.ids[1] == 0u) && (extended.ids[2] == 5u));
+    EXPECT_TRUE(FindAny(extended, "x WARN") == std::optional<size_t>{0});
+    EXPECT_TRUE(FindAny(extended, "err") == std::optional<size_t>{5});
+    EXPECT_TRUE(FindAny(extended, "d") == std::optional<size_t>{4});
+
+    std::vector<std::string> many;
+    for (size_t i = 0; i < 600; ++i) many.push_back("word" + std::to_string(i) + "x");
+    const auto large = CompileSet({many.begin(), many.end()}, true, false);
+    EXPECT_TRUE(large.matchers.size() == 3u);
+    EXPECT_TRUE(large.matchers[0].re.buffer_searchable);
+    EXPECT_TRUE(FindAny(large, "a word517x b") == std::optional<size_t>{517});
+  }
+
+  // ProcessBuffer finds the same lines as Process
+  {
+    const std::string_view content = "foo bar\nbar\n\n  x\nfoo\nbarfoo\nlast foo";
+    for (const char* filter : {"foo", "^bar", "foo$", "\\s+x", "bar\\s+foo", "r[^z]*f", "o\\nb", "zzz",
+                               "(?<!bar)foo", "oo\\z"}) {
+      EXPECT_TRUE(RunProcess(content, filter, true) == RunProcess(content, filter, false));
+    }
+    EXPECT_TRUE(RunProcess(content, "foo", true) == "1:foo bar\n5:foo\n6:barfoo\n7:last foo\n");
+    EXPECT_TRUE(RunProcess(content, "foo", true, "@2@6@") == RunProcess(content, "foo", false, "@2@6@"));
+  }
+
+  // Context, merged windows and separators, limited by the range; stdin
+  // keeps the lines before a match in its block
+  {
+    std::string content;
+    for (int i = 1; i <= 12; ++i) content.append("l").append(std::to_string(i)).append("\n");
+    const std::string expected = "2-l2\n3:l3\n4:l4\n5-l5\n--\n8-l8\n9:l9\n10-l10\n";
+    EXPECT_TRUE(RunProcess(content, "l[349]$", true, "", 1, 1) == expected);
+    EXPECT_TRUE(RunProcess(content, "l[349]$", false, "", 1, 1) == expected);
+    EXPECT_TRUE(RunProcess(content, "l[39]$", true, "", 2, 0) == "1-l1\n2-l2\n3:l3\n--\n7-l7\n8-l8\n9:l9\n");
+    EXPECT_TRUE(RunProcess(content, "l[12]$", true, "", 0, 3) == "1:l1\n2:l2\n3-l3\n4-l4\n5-l5\n");
+    EXPECT_TRUE(RunProcess(content, "l(4|6|11)$", true, "@4@9@", 2, 2) == "4:l4\n5-l5\n6:l6\n7-l7\n8-l8\n");
+    EXPECT_TRUE(RunProcess(content, "l(4|6|11)$", false, "@4@9@", 2, 2) == "4:l4\n5-l5\n6:l6\n7-l7\n8-l8\n");
+
+    FILE* f = TempFile(content);
+    InputStream stream(fileno(f), 4);
+    std::string out;
+    OutputSink sink(out, true, ":");
+    sink.SetContext(1, 1);
+    std::optional<Range> range;
+    Process(CompileSet({"l[349]$"}, true, false), {}, {}, sink, range, &stream);
+    EXPECT_TRUE(out == expected);
+    std::fclose(f);
+  }
+
+  // Counts, files with matches and the match limit; reading stops once the
+  // answer is known
+  {
+    const std::string_view content = "a1\nb\na2\na3\nb\na4\n";
+    const Pcre2PatternSet filters = CompileSet({"a"}, true, false);
+    std::optional<Range> range;
+    const auto run = [&](OutputSink::Mode mode, size_t max_count, bool whole_buffer) {
+      std::string out;
+      OutputSink sink(out, false, ":");
+      sink.SetFilename("f");
+      sink.SetMode(mode);
+      sink.SetMaxCount(max_count);
+      if (whole_buffer) {
+        ProcessBuffer(filters, {}, {}, sink, range, content);
+      } else {
+        InputMemMappedFile input(content.data(), content.data() + content.size());
+        Process(filters, {}, {}, sink, range, &input);
+      }
+      sink.EndFile();
+      return out;
+    };
+    for (const bool whole_buffer : {true, false}) {
+      EXPECT_TRUE(run(OutputSink::Mode::kCount, 0, whole_buffer) == "f:4\n");
+      EXPECT_TRUE(run(OutputSink::Mode::kCount, 2, whole_buffer) == "f:2\n");
+      EXPECT_TRUE(run(OutputSink::Mode::kFilesWithMatches, 0, whole_buffer) == "f\n");
+      EXPECT_TRUE(run(OutputSink::Mode::kLines, 3, whole_buffer) == "a1\na2\na3\n");
+    }
+
+    InputMemMappedFile input(content.data(), content.data() + content.size());
+    std::string out;
+    OutputSink sink(out, false, ":");
+    sink.SetMode(OutputSink::Mode::kFilesWithMatches);
+    Process(CompileSet({"a2"}, true, false), {}, {}, sink, range, &input);
+    EXPECT_TRUE(input.GetLine() == "a3");
+    sink.EndFile();
+    EXPECT_TRUE(out == "(standard input)\n");
+
+    // no match: nothing for -l, a zero count for -c
+    out.clear();
+    sink.SetMode(OutputSink::Mode::kCount);
+    sink.SetFilename("g");
+    ProcessBuffer(CompileSet({"zzz"}, true, false), {}, {}, sink, range, content);
+    sink.EndFile();
+    EXPECT_TRUE(out == "g:0\n");
+  }
+
+  // -o prints every match or the chosen groups, straight from the source
+  {
+    const std::string_view content = "k=1 v=22 k=333\nnone\nv=4 k=\n";
+    const auto run = [&](const std::vector<std::string_view>& filters, std::vector<size_t> groups, bool whole_buffer) {
+      std::string out;
+      OutputSink sink(out, true, ":");
+      sink.SetGroups(std::move(groups));
+      std::optional<Range> range;
+      if (whole_buffer) {
+        ProcessBuffer(CompileSet(filters, true, false), {}, {}, sink, range, content);
+      } else {
+        InputMemMappedFile input(content.data(), content.data() + content.size());
+        Process(CompileSet(filters, true, false), {}, {}, sink, range, &input);
+      }
+      return out;
+    };
+    for (const bool whole_buffer : {true, false}) {
+      EXPECT_TRUE(run({"k=\\d+"}, {0}, whole_buffer) == "1:k=1\n1:k=333\n");
+      EXPECT_TRUE(run({"(\\w)=(\\d*)"}, {2, 1}, whole_buffer) == "1:1:k\n1:22:v\n1:333:k\n3:4:v\n3::k\n");
+      EXPECT_TRUE(run({"k=(\\d+)", "v=(\\d+)"}, {1}, whole_buffer) == "1:1\n1:22\n1:333\n3:4\n");
+      EXPECT_TRUE(run({"x*"}, {0}, whole_buffer).empty());
+    }
+    auto regex = Regex(Compile("(a)|(b)", true, false));
+    EXPECT_TRUE(Search(regex, "xb").has_value());
+    EXPECT_TRUE(!CapturedGroup(regex, 1).has_value() && (CapturedGroup(regex, 2)->start == 1u));
+    EXPECT_TRUE(!CapturedGroup(regex, 3).has_value());
+
+    // a line with several matches is counted once
+    FILE* f = std::tmpfile();
+    {
+      OutputSink sink(fileno(f), false, "|");
+      sink.SetSource(content);
+      sink.SetGroups({0, 0});
+      sink.SetMaxCount(1);
+      sink.EmitMatch({content.substr(0, 3), "copy"}, 1);
+      sink.EmitMatch({content.substr(4, 4)}, 1);
+      EXPECT_TRUE(sink.Done());
+    }
+    EXPECT_TRUE(ReadBack(f) == "k=1|copy\nv=22\n");
+    std::fclose(f);
+  }
+
+  // Invalid UTF-8 is repaired, skipped or kept, as the policy says
+  {
+    const std::string_view content = "h\xC3\xA9llo\nbad \xFF hello\nhello\n";
+    const std::vector<std::pair<InvalidUtf8, std::string_view>> expected{
+      {InvalidUtf8::kReplace, "h\xC3\xA9llo\nbad \xEF\xBF\xBD hello\nhello\n"},
+      {InvalidUtf8::kSkip, "h\xC3\xA9llo\nhello\n"},
+      {InvalidUtf8::kBytes, content}};
+    for (const auto& [policy, printed] : expected) {
+      for (const bool jit : {true, false}) {
+        const Pcre2PatternSet filters = CompileSet({"h.llo"}, jit, true, policy);
+        EXPECT_TRUE(SubjectsValidated(filters.matchers[0].re) == (policy != InvalidUtf8::kBytes));
+        EXPECT_TRUE(SubjectPolicy(filters, {}, {}, std::nullopt) ==
+                    ((policy != InvalidUtf8::kBytes) ? std::optional{policy} : std::nullopt));
+        for (const bool whole_buffer : {true, false}) {
+          std::string out;
+          OutputSink sink(out, false, ":");
+          std::optional<Range> range;
+          if (whole_buffer) {
+            ProcessBuffer(filters, {}, {}, sink, range, content);
+          } else {
+            InputMemMappedFile input(content.data(), content.data() + content.size());
+            Process(filters, {}, {}, sink, range, &input);
+          }
+          EXPECT_TRUE(out == printed);
+        }
+        std::string out;
+        Pipeline pipeline(PipelineSpec{{"h.llo"}, {}, {}, "", jit, true, policy});
+        pipeline.Push(content, [&out](std::string_view line, size_t) { out.append(line).append("\n"); });
+        EXPECT_TRUE(out == printed);
+      }
+    }
+    // the policy belongs to the pattern, byte patterns compiled alongside keep
+    // matching invalid UTF-8 as it is
+    const Pcre2PatternSet validated = CompileSet({"bad"}, true, true, InvalidUtf8::kSkip);
+    const Pcre2PatternSet bytes = CompileSet({"bad"}, true, false, InvalidUtf8::kSkip);
+    EXPECT_TRUE(!SubjectsValidated(bytes.matchers[0].re));
+    for (const Pcre2PatternSet* filters : {&validated, &bytes}) {
+      std::string out;
+      OutputSink sink(out, false, ":");
+      std::optional<Range> range;
+      ProcessBuffer(*filters, {}, {}, sink, range, content);
+      EXPECT_TRUE(out == ((filters == &bytes) ? "bad \xFF hello\n" : ""));
+    }
+  }
+
+  // WorkStealingPool
+  {
+    std::vector<int> done(200, 0);
+    WorkStealingPool pool(4);
+    for (size_t i = 0; i < done.size(); ++i) {
+      pool.Submit([&done, i](size_t worker) { done[i] = static_cast<int>(worker) + 1; });
+    }
+    pool.Wait();
+    EXPECT_TRUE(std::all_of(done.begin(), done.end(), [](int d) { return (d >= 1) && (d <= 4); }));
+
+    pool.Submit([](size_t) { throw std::runtime_error("task failed"); });
+    EXPECT_THROWS(pool.Wait());
+  }
+
+  // Compiled patterns are shared between threads
+  {
+    const auto set = CompileSet({"alpha", "be+ta", "gam+a", "del(ta)", "(e)(p)(s)"}, true, false);
+    std::vector<int> ok(400, 0);
+    WorkStealingPool pool(4);
+    for (size_t i = 0; i < ok.size(); ++i) {
+      pool.Submit([&set, &ok, i](size_t) {
+        const std::string line = "x " + std::string(i % 5, 'm') + ((i % 2) ? " delta" : " beeta");
+        ok[i] = (FindAny(set, line) == std::optional<size_t>{(i % 2) ? 3u : 1u});
+      });
+    }
+    pool.Wait();
+    EXPECT_TRUE(std::all_of(ok.begin(), ok.end(), [](int v) { return v == 1; }));
+  }
+
+  // Pattern ids are reused and the cached match data grows with the captures
+  {
+    size_t id = 0;
+    {
+      auto small = Regex(Compile("ab", true, false));
+      EXPECT_TRUE(Find(small, "xab"));
+      id = small.id;
+    }
+    auto large = Regex(Compile("(a)(b)(c)(d)(e)", true, false));
+    EXPECT_TRUE(large.id == id);
+    EXPECT_TRUE(large.ovector_pairs == 6u);
+    auto span = Search(large, "xxabcde");
+    EXPECT_TRUE(span.has_value() && (span->start == 2u) && (span->end == 7u));
+  }
+
+  // Pattern cache
+  {
+    const TempDir dir("pattern_cache");
+    EnablePatternCache(dir.Path().string());
+    {
+      auto stored = Regex(Compile("cach(ed|ing)", true, false));
+      EXPECT_TRUE(Find(stored, "caching"));
+    }
+    EXPECT_TRUE(LoadCachedPatterns("pattern:cach(ed|ing)", PCRE2_MULTILINE | PCRE2_UTF | PCRE2_UCP).empty());
+    std::vector<CachedPattern> stored_entry = LoadCachedPatterns("pattern:cach(ed|ing)", PCRE2_MULTILINE);
+    EXPECT_TRUE((stored_entry.size() == 1u) && (stored_entry[0].pattern == "cach(ed|ing)") && (stored_entry[0].code != nullptr));
+    for (CachedPattern& c : stored_entry) pcre2_code_free(c.code);
+
+    auto loaded = Regex(Compile("cach(ed|ing)", true, false));
+    EXPECT_TRUE(loaded.re.jitted && Find(loaded, "cached") && !Find(loaded, "caches"));
+
+    const std::vector<std::string_view> patterns{"one", "tw+o", "th(r)ee", "four", "(?<n>fi)ve"};
+    for (int round = 0; round < 2; ++round) {  // stored, then loaded
+      const auto set = CompileSet(patterns, true, false);
+      EXPECT_TRUE((set.matchers.size() == 2u) && (set.ids[1] == 4u));
+      EXPECT_TRUE(set.matchers[0].re.buffer_searchable && set.matchers[1].re.buffer_searchable);
+      EXPECT_TRUE((FindAny(set, "xthree") == std::optional<size_t>{2}) && (FindAny(set, "five") == std::optional<size_t>{4}));
+    }
+
+    // damaged entries are ignored
+    for (const auto& entry : std::filesystem::directory_iterator{dir.Path()}) {
+      std::filesystem::resize_file(entry.path(), std::filesystem::file_size(entry.path()) - 8);
+    }
+    EXPECT_TRUE(Find(Regex(Compile("cach(ed|ing)", true, false)), "cached"));
+    EnablePatternCache("");
+  }
+
+  // LineIndex seeks and splits like a newline count would
+  {
+    std::string content;
+    for (int i = 1; i <= 50; ++i) content.append(std::to_string(i)).append("\n");
+    content.append("tail");
+    LineIndex index;
+    index.lines_per_entry = 4;
+    index.Extend(std::string_view(content).substr(0, 40));
+    const size_t partial = index.offsets.size();
+    index.Extend(content);
+    EXPECT_TRUE((partial < index.offsets.size()) && (index.offsets.size() == 13u));
+    EXPECT_TRUE(index.offsets[1] == SkipLines(content, 4));
+    for (const size_t n : {0u, 1u, 4u, 7u, 48u, 50u, 51u}) EXPECT_TRUE(index.SkipLines(content, n) == SkipLines(content, n));
+
+    for (const char* expr : {"@10@20@", "@5@@", "@@9@", "@49@60@", "@70@@"}) {
+      const std::optional<Range> range = ParseRange(expr, false, false);
+      const RangeSlice indexed = SliceToRange(range, content, 0, &index);
+      const RangeSlice counted = SliceToRange(range, content, 0);
+      EXPECT_TRUE((indexed.buffer == counted.buffer) && (indexed.linenum == counted.linenum));
+    }
+
+    std::vector<std::string_view> chunks;
+    std::vector<size_t> first_linenum;
+    const RangeSlice slice = SliceToRange(ParseRange("@3@@", false, false), content, 0);
+    index.Split(content, slice.buffer, slice.linenum, 30, chunks, first_linenum);
+    std::string joined;
+    for (size_t c = 0; c < chunks.size(); ++c) {
+      EXPECT_TRUE((c == 0) || ((chunks[c - 1].size() >= 30) && chunks[c - 1].ends_with('\n')));
+      EXPECT_TRUE(CountNewlines(std::string_view(content.data(), chunks[c].data() - content.data())) == first_linenum[c]);
+      joined.append(chunks[c]);
+    }
+    EXPECT_TRUE((chunks.size() > 1) && (joined == slice.buffer));
+  }
+
+  // Line index on disk: stored, extended after the file grew, rebuilt after it changed
+  {
+    namespace fs = std::filesystem;
+    const TempDir root("line_index");
+    const std::string path = (root / "big.log").string();
+    std::string content;
+    for (size_t i = 0; content.size() < kMinIndexedSize; ++i) content.append("line ").append(std::to_string(i)).append("\n");
+    auto fresh = [](std::string_view data) {
+      LineIndex index;
+      index.Extend(data);
+      return index.offsets;
+    };
+    EXPECT_TRUE(!GetLineIndex(path, content).has_value());  // disabled
+    EnableLineIndex((root / "index").string());
+    WriteFile(path, content);
+    EXPECT_TRUE(GetLineIndex(path, content)->offsets == fresh(content));
+    EXPECT_TRUE(!fs::is_empty(root / "index"));
+    EXPECT_TRUE(GetLineIndex(path, content)->offsets == fresh(content));
+
+    content.append(content.substr(0, 4 << 20));
+    WriteFile(path, content);
+    std::optional<LineIndex> grown = GetLineIndex(path, content);
+    EXPECT_TRUE(grown && (grown->offsets == fresh(content)) && (grown->indexed_size == content.size()));
+
+    content.replace(0, 5, "LINE\n");
+    WriteFile(path, content);
+    EXPECT_TRUE(GetLineIndex(path, content)->offsets == fresh(content));
+    EXPECT_TRUE(!GetLineIndex(path, std::string_view(content).substr(0, 100)).has_value());
+    EnableLineIndex("");
+
+    // threads of one run writing the same entry never mix their files
+    const fs::path entry = root / "entry";
+    std::vector<std::thread> writers;
+    for (const char c : {'a', 'b', 'c', 'd'}) {
+      writers.emplace_back([&entry, c]() {
+        for (int i = 0; i < 50; ++i) WriteFileAtomically(entry, std::string(1 << 16, c));
+      });
+    }
+    for (std::thread& writer : writers) writer.join();
+    std::ifstream written{entry, std::ios::binary};
+    const std::string data{std::istreambuf_iterator<char>{written}, std::istreambuf_iterator<char>{}};
+    EXPECT_TRUE((data.size() == (1u << 16)) && (data.find_first_not_of(data[0]) == std::string::npos));
+    EXPECT_TRUE(std::none_of(fs::directory_iterator{root.Path()}, fs::directory_iterator{},
+                             [](const fs::directory_entry& e) { return e.path().extension() == ".tmp"; }));
+  }
+
+  // BatchReader, with io_uring where available and with plain reads
+  {
+    const TempDir root("batch");
+    const std::string large(BatchReader::kMaxFileSize + 1, 'x');
+    const std::vector<std::string> contents{"one\ntwo\n", "", large, "three"};
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < contents.size(); ++i) {
+      paths.push_back((root / std::to_string(i)).string());
+      WriteFile(paths.back(), contents[i]);
+    }
+    paths.push_back((root / "missing").string());
+    paths.push_back(root.Path().string());
+
+    for (bool use_io_uring : {true, false}) {
+      BatchReader reader(use_io_uring);
+      for (int round = 0; round < 2; ++round) {  // buffers are reused
+        const std::vector<BatchedFile>& read = reader.Read(paths);
+        EXPECT_TRUE(read.size() == paths.size());
+        EXPECT_TRUE(read[0].ok && (read[0].contents == contents[0]));
+        EXPECT_TRUE(read[1].ok && read[1].contents.empty());
+        EXPECT_TRUE(!read[2].ok && read[2].deferred);
+        EXPECT_TRUE(read[3].ok && (read[3].contents == contents[3]));
+        EXPECT_TRUE(!read[4].ok && !read[4].deferred);
+        EXPECT_TRUE(!read[5].ok && read[5].deferred);
+      }
+    }
+  }
+
+  // LoadFile and FilePrefetcher, below and above the mmap threshold
+  {
+    const TempDir root("loader");
+    const common::LoadOptions options{.mmap_threshold = 64};
+    const std::vector<std::string> contents{"small\n", std::string(100, 'y'), ""};
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < contents.size(); ++i) {
+      paths.push_back((root / std::to_string(i)).string());
+      WriteFile(paths.back(), contents[i]);
+    }
+    paths.push_back((root / "missing").string());
+
+    std::error_code ec;
+    const common::LoadedFile small = common::LoadFile(paths[0], options, ec);
+    EXPECT_TRUE(!ec && !small.IsMapped() && (small.View() == contents[0]));
+    const common::LoadedFile large = common::LoadFile(paths[1], options, ec);
+    EXPECT_TRUE(!ec && large.IsMapped() && (large.View() == contents[1]));
+    EXPECT_TRUE(common::LoadFile(paths[3], options, ec).size() == 0 && ec);
+
+    common::FilePrefetcher prefetcher(options);
+    for (const std::string& path : paths) prefetcher.Push(path);
+    EXPECT_TRUE(prefetcher.Pending() == paths.size());
+    for (size_t i = 0; i < paths.size(); ++i) {
+      const common::PrefetchedFile loaded = prefetcher.Pop();
+      EXPECT_TRUE(loaded.path == paths[i]);
+      EXPECT_TRUE((i < contents.size()) ? (!loaded.ec && (loaded.file.View() == contents[i])) : bool(loaded.ec));
+    }
+    EXPECT_TRUE(prefetcher.Pending() == 0);
+  }
+
+  // DecompressingInput, with lines across block boundaries and several
+  // gzip members or zstd frames
+  {
+    const std::string long_line(DecompressingInput::kBlockSize + 10, 'z');
+    std::string text;
+    std::vector<std::string> expected;
+    for (size_t i = 0; i < 200000; ++i) expected.push_back("line " + std::to_string(i));
+    expected.push_back(long_line);
+    expected.push_back("last");
+    for (const std::string& line : expected) text.append(line).append("\n");
+    text.pop_back();
+    const size_t half = text.size() / 2;
+
+    EXPECT_TRUE(DetectCompression(Gzip("x")) == Compression::kGzip);
+    EXPECT_TRUE(DetectCompression(Zstd("x")) == Compression::kZstd);
+    EXPECT_TRUE(DetectCompression("plain") == Compression::kNone);
+    for (const Compression c : {Compression::kGzip, Compression::kZstd}) {
+      auto compress = [c](std::string_view data) { return (c == Compression::kGzip) ? Gzip(data) : Zstd(data); };
+      const std::string compressed = compress(text.substr(0, half)) + compress(text.substr(half));
+      DecompressingInput input(compressed, c);
+      EXPECT_TRUE(ReadLines(input) == expected);
+
+      const std::string truncated = compressed.substr(0, compressed.size() / 3);
+      DecompressingInput broken(truncated, c);
+      bool corrupt = false;
+      try {
+        ReadLines(broken);
+      } catch (const DecompressError&) {
+        corrupt = true;
+      }
+      EXPECT_TRUE(corrupt);
+      // abandoned half way, the reader thread has to stop
+      DecompressingInput abandoned(compressed, c);
+      EXPECT_TRUE(abandoned.GetLine() == "line 0");
+    }
+
+    std::string out;
+    OutputSink sink(out, true, ":");
+    std::optional<Range> range;
+    ProcessContents(CompileSet({"^line 1999\\d$"}, true, false), {}, {}, sink, range, Gzip("a\nline 19990\nb\n"));
+    EXPECT_TRUE(out == "2:line 19990\n");
+  }
+
+  // Follower: appends, an unterminated line, rename rotation and truncation
+  {
+    namespace fs = std::filesystem;
+    const TempDir root("follow");
+    const std::string path = (root / "app.log").string();
+    auto append = [](const std::string& file, std::string_view text) { WriteFile(file, text, true); };
+    append(path, "keep 1\nskip\n");
+
+    const Patterns patterns{CompileSet({"keep"}, true, false), {}, {}, std::nullopt};
+    std::string out;
+    OutputSink sink(out, true, ":");
+    Follower follower({path}, patterns, sink);
+    EXPECT_TRUE(out == path + ":1:keep 1\n");
+    out.clear();
+
+    append(path, "keep 2\nkeep ");
+    follower.Step(1000);
+    append(path, "3\n");
+    follower.Step(1000);
+    EXPECT_TRUE(out == path + ":3:keep 2\n" + path + ":4:keep 3\n");
+    out.clear();
+
+    fs::rename(path, path + ".1");
+    append(path + ".1", "keep old\n");
+    append(path, "keep new\n");
+    for (int i = 0; (i < 10) && (out.find("keep new") == std::string::npos); ++i) follower.Step(100);
+    EXPECT_TRUE(out == path + ":5:keep old\n" + path + ":6:keep new\n");
+    out.clear();
+
+    fs::resize_file(path, 0);
+    follower.Step(1000);
+    append(path, "keep truncated\n");
+    for (int i = 0; (i < 10) && out.empty(); ++i) follower.Step(100);
+    EXPECT_TRUE(out == path + ":7:keep truncated\n");
+
+    // context reaches into earlier appends and is still owed after a match
+    const std::string context_path = (root / "context.log").string();
+    append(context_path, "a\nb\n");
+    std::string context_out;
+    OutputSink context_sink(context_out, true, ":");
+    context_sink.SetContext(1, 1);
+    Follower context_follower({context_path}, patterns, context_sink);
+    EXPECT_TRUE(context_out.empty());
+    append(context_path, "keep\n");
+    context_follower.Step(1000);
+    append(context_path, "c\nd\n");
+    context_follower.Step(1000);
+    EXPECT_TRUE(context_out == context_path + "-2-b\n" + context_path + ":3:keep\n" + context_path + "-4-c\n");
+
+    // a readable stop descriptor ends following
+    int stop[2] = {-1, -1};
+    EXPECT_TRUE(::pipe(stop) == 0);
+    EXPECT_TRUE(context_follower.Step(0, stop[0]));
+    EXPECT_TRUE(::write(stop[1], "x", 1) == 1);
+    EXPECT_TRUE(!context_follower.Step(1000, stop[0]));
+    ::close(stop[0]);
+    ::close(stop[1]);
+  }
+
+  // Pipeline: pushed in chunks of every size, it prints what Process() prints
+  {
+    const std::string content = "a 1\nb 2\na 3\nx a 4\nstart\na 5\na 6\nend\na 7";
+    const std::vector<PipelineSpec> specs{
+      {{"a"}, {"x"}, {"@(\\d)@<$1>@"}, "", true, false},
+      {{"a"}, {}, {}, "@2@6@", false, false},
+      {{"a \\d", "b"}, {}, {}, "@3@@", true, false},
+      {{}, {}, {}, "@start@end@", true, false}};
+    for (const PipelineSpec& spec : specs) {
+      const std::shared_ptr<const Patterns> patterns = CompilePipeline(spec);
+      std::string expected;
+      {
+        OutputSink sink(expected, true, ":");
+        std::optional<Range> range = patterns->range;
+        InputMemMappedFile input(content.data(), content.data() + content.size());
+        Process(patterns->filters, patterns->excludes, patterns->replacements, sink, range, &input);
+      }
+      Pipeline pipeline(patterns);
+      std::string out;
+      auto sink = [&out](std::string_view line, size_t linenum) {
+        out.append(std::to_string(linenum)).append(":").append(line).append("\n");
+      };
+      for (size_t chunk_size = 1; chunk_size <= content.size(); ++chunk_size) {
+        out.clear();
+        for (size_t pos = 0; pos < content.size(); pos += chunk_size) {
+          pipeline.Push(std::string_view{content}.substr(pos, chunk_size), sink);
+        }
+        pipeline.Finish(sink);
+        EXPECT_TRUE(out == expected);
+      }
+    }
+    // a finished line based range takes no more input, searched or not
+    for (const std::vector<std::string>& filters : {std::vector<std::string>{}, std::vector<std::string>{"o"}}) {
+      Pipeline pipeline(PipelineSpec{filters, {}, {}, "@1@2@"});
+      size_t lines = 0;
+      pipeline.Push("one\ntwo\nthree\n", [&lines](std::string_view, size_t) { ++lines; });
+      EXPECT_TRUE(pipeline.Done() && (lines == 1u));
+      pipeline.Push("four\n", [&lines](std::string_view, size_t) { ++lines; });
+      EXPECT_TRUE(lines == 1u);
+    }
+    EXPECT_THROWS(Pipeline(PipelineSpec{{"("}}));
+
+    // every pipeline keeps to its own spec's invalid UTF-8 policy: binary
+    // subjects stay as they are next to a pipeline that repairs them
+    Pipeline binary(PipelineSpec{{"a"}, {}, {}, "", true, false});
+    Pipeline repairing(PipelineSpec{{"a"}, {}, {}, "", true, true, InvalidUtf8::kReplace});
+    std::string binary_out;
+    std::string repaired_out;
+    for (int i = 0; i < 2; ++i) {
+      binary.Push("a\xFF\x01\n", [&binary_out](std::string_view line, size_t) { binary_out.append(line); });
+      repairing.Push("a\xFF\x01\n", [&repaired_out](std::string_view line, size_t) { repaired_out.append(line); });
+    }
+    EXPECT_TRUE(binary_out == "a\xFF\x01" "a\xFF\x01");
+    EXPECT_TRUE(repaired_out == "a\xEF\xBF\xBD\x01" "a\xEF\xBF\xBD\x01");
+  }
+
+  // Walk
+  {
+    namespace fs = std::filesystem;
+    const TempDir root("walk");
+    for (const char* dir : {"b/c", ".git", "skip"}) fs::create_directories(root / dir);
+    for (const char* file : {"a.log", "b/x.log", "b/c/y.log", "b/c/y.tmp", ".git/config", "skip/z.log", ".hidden"}) {
+      WriteFile(root / file, "");
+    }
+    std::vector<std::string> found;
+    Walk(root.Path().string(), WalkOptions{{"skip", "*.tmp"}}, [&found, &root](std::string path) {
+      found.push_back(fs::path{path}.lexically_relative(root.Path()).string());
+    });
+    EXPECT_TRUE((found == std::vector<std::string>{"a.log", "b/c/y.log", "b/x.log"}));
+    EXPECT_TRUE(IsDirectory(root.Path().string()) && !IsDirectory((root / "a.log").string()));
+  }
+
+  // OrderedWriter
+  {
+    FILE* f = std::tmpfile();
+    OrderedWriter writer(f);
+    std::string out;
+    for (size_t i : {2u, 0u, 3u, 1u}) {
+      out = std::to_string(i);
+      writer.Complete(i, out);
+      EXPECT_TRUE(out.empty());
+    }
+    EXPECT_TRUE(ReadBack(f) == "0123");
+    std::fclose(f);
+
+    // split slots are written in their parent's place, whichever arrives first
+    f = std::tmpfile();
+    OrderedWriter split_writer(f);
+    const auto complete = [&split_writer](const OrderedWriter::Slot& slot, const char* text) {
+      std::string piece = text;
+      split_writer.Complete(slot, piece);
+    };
+    complete({2}, "e");
+    complete({1, 1, 0}, "c");
+    complete({0}, "a");
+    split_writer.Split({1, 1}, 2);
+    complete({1, 0}, "b");
+    complete({1, 1, 1}, "d");
+    split_writer.Split({1, 2}, 0);
+    split_writer.Split({1}, 3);
+    EXPECT_TRUE(ReadBack(f) == "abcde");
+    std::fclose(f);
+  }
+
+  // ProcessFilesParallel: output is that of a serial walk, whichever worker
+  // lists or scans what first
+  {
+    namespace fs = std::filesystem;
+    const TempDir root("search");
+    for (int d = 0; d < 6; ++d) fs::create_directories(root / "logs" / std::to_string(d) / "sub");
+    std::vector<std::string> inputs{(root / "logs").string(), (root / "top.log").string()};
+    for (int d = 0; d < 6; ++d) {
+      const fs::path dir = root / "logs" / std::to_string(d);
+      for (int k = 0; k < 20; ++k) {
+        WriteFile(dir / (std::to_string(k) + ".log"), "keep this\ndrop this\n");
+        WriteFile(dir / "sub" / (std::to_string(k) + ".log"), "keep this\ndrop this\n");
+      }
+    }
+    WriteFile(inputs[1], "keep top\n");
+    std::vector<std::string> files;
+    Walk(inputs[0], WalkOptions{}, [&files](std::string path) { files.push_back(std::move(path)); });
+    std::string expected;
+    for (const std::string& file : files) expected += file + ":1:keep this\n";
+    expected += inputs[1] + ":1:keep top\n";
+
+    const Patterns patterns{CompileSet({"keep"}, true, false), {}, {}, std::nullopt};
+    const std::vector<std::string_view> views(inputs.begin(), inputs.end());
+    for (int run = 0; run < 4; ++run) {
+      std::FILE* f = std::tmpfile();
+      ProcessFilesParallel(views, WalkOptions{}, 4, false, common::LoadOptions{}, patterns,
+                           OutputOptions{true, ":"}, f);
+      EXPECT_TRUE(ReadBack(f) == expected);
+      std::fclose(f);
+    }
+  }
+
+  // Stats: evaluations and hits of tracked patterns, lines and bytes scanned.
+  // Last, since counting stays on once enabled.
+  {
+    EnableStats();
+    const Pcre2PatternSet filters = CompileSet({"b+"}, true, false);
+    TrackPattern("filter", filters.matchers[0].re);
+    std::string out;
+    OutputSink sink(out, false, ":");
+    std::optional<Range> range;
+    const std::string_view content = "a\nbb\nc\nb";
+    InputMemMappedFile input(content.data(), content.data() + content.size());
+    Process(filters, {}, {}, sink, range, &input);
+
+    FILE* f = std::tmpfile();
+    ReportStats(f);
+    const std::string report = ReadBack(f);
+    EXPECT_TRUE(report.starts_with("filter\tb+\tjit=yes\tevaluations=4\thits=2\t"));
+    EXPECT_TRUE(report.find("input\tbytes=0\tlines=4\t") != std::string_view::npos);
+    std::fclose(f);
+
+    // members of a combined program are reported as given, with their own hits
+    const Pcre2PatternSet set = CompileSet({"x1", "x2", "x3", "x4", "(*UCP)y"}, true, false);
+    TrackPatternSet("exclude", set);
+    const std::string_view lines = "x2\ny\nx4\nx2\n";
+    InputMemMappedFile set_input(lines.data(), lines.data() + lines.size());
+    Process(set, {}, {}, sink, range, &set_input);
+    f = std::tmpfile();
+    ReportStats(f);
+    const std::string set_report = ReadBack(f);
+    EXPECT_TRUE(set_report.find("exclude\tx1\tjit=yes\tevaluations=4\thits=0\t") != std::string_view::npos);
+    EXPECT_TRUE(set_report.find("exclude\tx2\tjit=yes\tevaluations=4\thits=2\t") != std::string_view::npos);
+    EXPECT_TRUE(set_report.find("exclude\tx4\tjit=yes\tevaluations=4\thits=1\t") != std::string_view::npos);
+    EXPECT_TRUE(set_report.find("ms\tcombined=4\n") != std::string_view::npos);
+    EXPECT_TRUE(set_report.find("exclude\t(*UCP)y\tjit=yes\tevaluations=1\thits=1\t") != std::string_view::npos);
+    EXPECT_TRUE(set_report.find("MARK") == std::string_view::npos);
+    std::fclose(f);
+  }
+
   return EXIT_SUCCESS;
 }
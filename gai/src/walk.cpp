@@ -0,0 +1,75 @@
+#include <algorithm>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+
+#include "walk.h"
+
+namespace gai {
+
+static bool IsIgnored(const std::string& name, const std::string& path, const WalkOptions& options) {
+  if (name.starts_with('.')) return true;
+  return std::any_of(options.ignore_globs.begin(), options.ignore_globs.end(), [&](std::string_view glob) {
+    const std::string pattern{glob};
+    return (::fnmatch(pattern.c_str(), name.c_str(), 0) == 0) ||
+           (::fnmatch(pattern.c_str(), path.c_str(), FNM_PATHNAME) == 0);
+  });
+}
+
+bool IsDirectory(const std::string& path) {
+  struct stat info{};
+  return (::stat(path.c_str(), &info) == 0) && S_ISDIR(info.st_mode);
+}
+
+void ListDirectory(const std::string& directory, const WalkOptions& options,
+                   const std::function<void(std::string)>& on_file,
+                   const std::function<void(std::string)>& on_directory) {
+  DIR* dir = ::opendir(directory.c_str());
+  if (!dir) return;
+
+  struct Entry {
+    std::string name;
+    bool is_directory{false};
+  };
+  std::vector<Entry> entries;
+  const std::string prefix = directory.ends_with('/') ? directory : directory + '/';
+  while (const dirent* e = ::readdir(dir)) {
+    std::string name{e->d_name};
+    if ((name == ".") || (name == "..")) continue;
+
+    // d_type saves a stat per entry on most filesystems
+    unsigned char type = e->d_type;
+    if ((type == DT_UNKNOWN) || (type == DT_LNK)) {
+      struct stat info{};
+      const std::string path = prefix + name;
+      if (::lstat(path.c_str(), &info) != 0) continue;
+      if (S_ISLNK(info.st_mode)) {
+        type = ((::stat(path.c_str(), &info) == 0) && S_ISREG(info.st_mode)) ? DT_REG : DT_LNK;
+      } else {
+        type = S_ISDIR(info.st_mode) ? DT_DIR : (S_ISREG(info.st_mode) ? DT_REG : DT_UNKNOWN);
+      }
+    }
+    if ((type == DT_REG) || (type == DT_DIR)) entries.push_back(Entry{std::move(name), type == DT_DIR});
+  }
+  ::closedir(dir);
+
+  std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.name < b.name; });
+  for (Entry& e : entries) {
+    std::string path = prefix + e.name;
+    if (IsIgnored(e.name, path, options)) continue;
+    if (e.is_directory) {
+      on_directory(std::move(path));
+    } else {
+      on_file(std::move(path));
+    }
+  }
+}
+
+void Walk(const std::string& root, const WalkOptions& options, const std::function<void(std::string)>& on_file) {
+  std::function<void(std::string)> on_directory = [&](std::string path) {
+    ListDirectory(path, options, on_file, on_directory);
+  };
+  on_directory(root);
+}
+
+} // namespace gai
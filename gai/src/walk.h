@@ -0,0 +1,33 @@
+#ifndef GAI_WALK_H_
+#define GAI_WALK_H_
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace gai {
+
+// Entries a directory walk leaves out besides hidden ones (names starting
+// with a dot). A glob is matched with fnmatch(3) against the entry name and
+// against its whole path.
+struct WalkOptions {
+  std::vector<std::string_view> ignore_globs;
+};
+
+bool IsDirectory(const std::string& path);
+
+// Reports the entries of `directory` in name order: regular files (also
+// through symlinks) to `on_file` and subdirectories to `on_directory`.
+// Symlinked directories are not followed and unreadable directories are
+// skipped.
+void ListDirectory(const std::string& directory, const WalkOptions& options,
+                   const std::function<void(std::string)>& on_file,
+                   const std::function<void(std::string)>& on_directory);
+
+// Depth first walk below `root` in name order.
+void Walk(const std::string& root, const WalkOptions& options, const std::function<void(std::string)>& on_file);
+
+} // namespace gai
+
+#endif // GAI_WALK_H_
@@ -5,10 +5,10 @@
 #include <string_view>
 
 #include <tree_sitter/api.h>
-#include <mio/mmap.hpp>
 
 #include "args.h"
 #include "config.h"
+#include "loader.h"
 #include "printx.hpp"
 
 constexpr const char* kVersion = "25.10.1";
@@ -37,25 +37,23 @@ static std::unordered_map<std::string, ParserFunctionPtr> kFileExtensionToParser
 };
 
 static std::string OpenFile(const fs::path& filename) {
-  mio::mmap_source contents;
   std::error_code ec;
-  contents.map(filename.c_str(), ec);
+  const common::LoadedFile contents = common::LoadFile(filename.string(), common::LoadOptions{}, ec);
 
   std::string out;
   if (ec) {
-    rostd::printf<"Error!! Unable to memory map input.\n\tFile: %s\n\tError Code: %d\n\tError Msg: %s\n">(
+    rostd::printf<"Error!! Unable to read input.\n\tFile: %s\n\tError Code: %d\n\tError Msg: %s\n">(
       filename, ec.value(), ec.message());
     return out;
   }
-  out.resize(contents.size());
-  std::copy(contents.begin(), contents.end(), out.begin());
+  out.assign(contents.View());
   return out;
 }
 
-static const char* MemMappedFileRead(void* payload, uint32_t byte_offset,
-                                     TSPoint position, uint32_t* bytes_read) {
+static const char* LoadedFileRead(void* payload, uint32_t byte_offset,
+                                  TSPoint position, uint32_t* bytes_read) {
   std::ignore = position;
-  mio::mmap_source* contents = static_cast<mio::mmap_source*>(payload);
+  const common::LoadedFile* contents = static_cast<const common::LoadedFile*>(payload);
   if (byte_offset >= contents->size()) {
     *bytes_read = 0;
     return nullptr;
@@ -73,43 +71,42 @@ static std::string_view LStrip(std::string_view v) {
   return v;
 }
 
-static void TreesitterParse(const fs::path& path,
-                            const std::unordered_map<std::string, LanguageInfo>& config,
-                            const std::unordered_map<std::string, TreesitterQuery>& queries) {
-  if (fs::file_size(path) == 0) return;
+// Query for the language of `path`, nullptr when none is configured.
+static const TreesitterQuery* FindQuery(const fs::path& path,
+                                        const std::unordered_map<std::string, LanguageInfo>& config,
+                                        const std::unordered_map<std::string, TreesitterQuery>& queries) {
   std::string file_extension = path.extension().string();
   std::transform(file_extension.begin(), file_extension.end(), file_extension.begin(),
                  ::tolower);
 
-  TSLanguage* language{nullptr};
-  TSQuery* query{nullptr};
   for (const auto& [lang, info] : config) {
     if (info.file_extensions.contains(file_extension) && queries.contains(lang)) {
       const TreesitterQuery& q = queries.at(lang);
-      language = q.language;
-      query = q.query;
-      break;
+      if ((q.language == nullptr) || (q.query == nullptr)) return nullptr;
+      return &q;
     }
   }
-  if ((language == nullptr) || (query == nullptr)) {
-    return;
-  }
+  return nullptr;
+}
 
-  mio::mmap_source contents;
-  std::error_code ec;
-  contents.map(path.c_str(), ec);
-  if (ec) {
-    rostd::printf<"Error!! Unable to memory map input file.\n\tFile: %s\n\tError Code: %d\n\tError Msg: %s\n">(
-      path, ec.value(), ec.message());
+static void TreesitterParse(const common::PrefetchedFile& file, const TreesitterQuery& q) {
+  const fs::path path{file.path};
+  const common::LoadedFile& contents = file.file;
+  if (file.ec) {
+    rostd::printf<"Error!! Unable to read input file.\n\tFile: %s\n\tError Code: %d\n\tError Msg: %s\n">(
+      path, file.ec.value(), file.ec.message());
     return;
   }
+  if (contents.size() == 0) return;
+  TSLanguage* const language = q.language;
+  TSQuery* const query = q.query;
 
   TSParser *parser = ts_parser_new();
   std::ignore = ts_parser_set_language(parser, language);
 
   TSInput parser_input{};
-  parser_input.payload = static_cast<void*>(&contents);
-  parser_input.read = MemMappedFileRead;
+  parser_input.payload = const_cast<void*>(static_cast<const void*>(&contents));
+  parser_input.read = LoadedFileRead;
   parser_input.encoding = TSInputEncoding::TSInputEncodingUTF8;
   TSTree* tree = ts_parser_parse(parser, NULL, parser_input);
   if (!tree) {
@@ -132,7 +129,7 @@ static void TreesitterParse(const fs::path& path,
       TSPoint start_point = ts_node_start_point(node);
       auto start_byte = ts_node_start_byte(node);
       auto end_byte = ts_node_end_byte(node);
-      std::string_view symbol_name(contents.begin() + start_byte, end_byte - start_byte);
+      std::string_view symbol_name(contents.data() + start_byte, end_byte - start_byte);
       symbol_name = LStrip(symbol_name);
       rostd::printf<"%s@%u@%u@%s\n">(path, start_point.row + 1, start_point.column + 1, symbol_name);
     }
@@ -222,9 +219,19 @@ Options:
   try {
     const std::unordered_map<std::string, LanguageInfo> config = ParseConfig(config_file);
     const std::unordered_map<std::string, TreesitterQuery> queries = InitializeQuery(cli, config);
+    // files are loaded on a background thread, the next one while the
+    // current one is parsed
+    std::vector<const TreesitterQuery*> file_queries;
+    common::FilePrefetcher prefetcher;
     for (const std::string_view& file : files) {
       if (!fs::exists(file)) continue;
-      TreesitterParse(fs::path{file}, config, queries);
+      const TreesitterQuery* q = FindQuery(fs::path{file}, config, queries);
+      if (q == nullptr) continue;
+      file_queries.push_back(q);
+      prefetcher.Push(std::string{file});
+    }
+    for (const TreesitterQuery* q : file_queries) {
+      TreesitterParse(prefetcher.Pop(), *q);
     }
   } catch (const std::exception& ex) {
     rostd::printf<"Exception raised!!\nException: %s\n">(ex.what());